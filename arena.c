@@ -0,0 +1,64 @@
+#include "header.h"
+
+/*
+ * Arenas
+ *
+ * An arena is a single block that arena_alloc carves up from
+ *    the front and arena_reset hands back all at once. The
+ *    parser sizes the arena for a whole command line before it
+ *    starts, so a line costs at most one allocation, and none
+ *    once the block is big enough for the lines the shell gets.
+ */
+
+/*
+ * arena_reset - Release everything allocated from arena and
+ *    make sure it holds at least size bytes. A block much
+ *    bigger than needed is given back, so one huge line does
+ *    not pin its memory for the life of the shell.
+ */
+void arena_reset(struct arena_t *arena, size_t size)
+{
+    arena->used = 0;
+
+    if (size < ARENAMIN) {
+        size = ARENAMIN;
+    }
+    if (size <= arena->size && arena->size <= 4 * size) {
+        return;
+    }
+
+    free(arena->base);
+    if ((arena->base = malloc(size)) == NULL) {
+        unix_error("arena_reset error");
+    }
+    arena->size = size;
+}
+
+/*
+ * arena_init - Give an arena that is kept, rather than reused,
+ *    a block of exactly size bytes
+ */
+void arena_init(struct arena_t *arena, size_t size)
+{
+    if ((arena->base = malloc(size)) == NULL) {
+        unix_error("arena_init error");
+    }
+    arena->size = size;
+    arena->used = 0;
+}
+
+/*
+ * arena_alloc - Allocate size bytes, aligned to ARENALIGN. The
+ *    caller has reserved enough room with arena_reset.
+ */
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+    void *p = arena->base + arena->used;
+
+    size = (size + ARENALIGN - 1) & ~(size_t)(ARENALIGN - 1);
+    if (size > arena->size - arena->used) {
+        app_error("arena_alloc error: arena overrun");
+    }
+    arena->used += size;
+    return p;
+}
@@ -0,0 +1,323 @@
+/*
+ * mpshbench - Microbenchmarks for the shell's hot paths
+ *
+ * Links against the shell's own objects (everything but main.o)
+ *    and times:
+ *
+ *    eval      fork/spawn + exec + reap round trips of /bin/true
+ *              through eval, as a foreground job
+ *    jobtable  addjob + getjobpid + deletejob cycles against a
+ *              table holding LIVEJOBS other jobs
+ *    parse_*   parseline on typical and adversarial lines
+ *    storm     STORMKIDS children exiting at once, from release
+ *              until the last one has been reaped
+ *
+ * Each benchmark prints one JSON object per line with its
+ *    throughput and latency percentiles, for scripts that
+ *    compare runs and flag regressions.
+ *
+ * usage: mpshbench [-fze] [-q]
+ *    -f  launch with fork/execve instead of posix_spawn
+ *    -z  launch through the zygote
+ *    -e  reap on the event loop (signalfd + pidfds)
+ *    -q  quick run, a tenth of the usual iterations
+ */
+
+#include "header.h"
+
+#define LIVEJOBS  256           /* jobs kept in the table by jobtable */
+#define STORMKIDS 500           /* children per SIGCHLD storm         */
+#define FAKEPID   0x40000000    /* jobtable PIDs, above any real PID  */
+
+/* Globals main.c defines for the shell */
+char promt[] = "mpsh> ";
+char verbose = 0;
+char launch_mode = LAUNCH_SPAWN;
+volatile sig_atomic_t atomic_fggpid = 0;
+
+extern char evloop;
+
+static int scale = 10;          /* iterations multiplier (-q: 1) */
+
+/* now_ns - Monotonic clock in nanoseconds */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* cmpns - qsort comparison of latencies */
+static int cmpns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * report - Print one result: n operations of size bytes each
+ *    (0 if not meaningful) taking total ns, with the latency of
+ *    each sample in lat. Sorts lat.
+ */
+static void report(const char *name, uint64_t *lat, int nlat,
+                   unsigned long n, size_t bytes, uint64_t total)
+{
+    double secs = total / 1e9;
+
+    qsort(lat, nlat, sizeof(*lat), cmpns);
+    printf("{\"bench\":\"%s\",\"launch\":\"%s\",\"reap\":\"%s\","
+           "\"ops\":%lu,\"ops_per_sec\":%.0f,",
+        name, launch_mode == LAUNCH_FORK ? "fork" :
+              launch_mode == LAUNCH_ZYGOTE ? "zygote" : "spawn",
+        evloop ? "evloop" : "handler", n, n / secs);
+    if (bytes) {
+        printf("\"mb_per_sec\":%.1f,", n * (double)bytes / secs / 1e6);
+    }
+    printf("\"p50_ns\":%lu,\"p90_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu}\n",
+        (unsigned long)lat[(nlat - 1) * 50 / 100],
+        (unsigned long)lat[(nlat - 1) * 90 / 100],
+        (unsigned long)lat[(nlat - 1) * 99 / 100],
+        (unsigned long)lat[nlat - 1]);
+    fflush(stdout);
+}
+
+/* xmalloc - malloc or die */
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        unix_error("bench: malloc error");
+    }
+    return p;
+}
+
+/* bench_eval - Foreground /bin/true round trips through eval */
+static void bench_eval(void)
+{
+    static const char line[] = "/bin/true";
+    int i, n = 100 * scale;
+    uint64_t *lat = xmalloc(n * sizeof(*lat));
+    uint64_t t, start = now_ns();
+
+    for (i = 0; i < n; i++) {
+        t = now_ns();
+        eval(line, sizeof(line) - 1);
+        lat[i] = now_ns() - t;
+    }
+    report("eval", lat, n, n, 0, now_ns() - start);
+    free(lat);
+}
+
+/*
+ * bench_jobtable - Churn the job table: each cycle adds a job,
+ *    looks up a live one by PID and deletes the oldest
+ */
+static void bench_jobtable(void)
+{
+    int i, n = 100000 * scale;
+    uint64_t *lat = xmalloc(n * sizeof(*lat));
+    uint64_t t, start;
+    pid_t next = FAKEPID;
+    sigset_t mask, prev;
+
+    Sigfillset(&mask);
+    lockjobs(&mask, &prev);
+
+    for (i = 0; i < LIVEJOBS; i++) {
+        addjob(&jobs, next++, BG, "bench", 5);
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        t = now_ns();
+        addjob(&jobs, next, BG, "bench", 5);
+        if (getjobpid(&jobs, next - LIVEJOBS / 2) == NULL) {
+            app_error("bench: job lookup failed");
+        }
+        deletejob(&jobs, next - LIVEJOBS);
+        next++;
+        lat[i] = now_ns() - t;
+    }
+    t = now_ns() - start;
+
+    for (i = LIVEJOBS; i > 0; i--) {
+        deletejob(&jobs, next - i);
+    }
+    unlockjobs(&prev);
+
+    report("jobtable", lat, n, n, 0, t);
+    free(lat);
+}
+
+/* repeat - A line of count copies of unit followed by tail */
+static char *repeat(const char *unit, int count, const char *tail, size_t *len)
+{
+    size_t ulen = strlen(unit), tlen = strlen(tail);
+    char *s = xmalloc(ulen * count + tlen + 1);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        memcpy(s + i * ulen, unit, ulen);
+    }
+    memcpy(s + ulen * count, tail, tlen + 1);
+    *len = ulen * count + tlen;
+    return s;
+}
+
+/* bench_parse1 - Time n parses of one line */
+static void bench_parse1(const char *name, const char *line, size_t len, int n)
+{
+    uint64_t *lat = xmalloc(n * sizeof(*lat));
+    uint64_t t, start = now_ns();
+    struct cmdline_t cmd;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        t = now_ns();
+        if (parseline(line, len, &cmd) < 0) {
+            app_error("bench: parse failed");
+        }
+        lat[i] = now_ns() - t;
+    }
+    report(name, lat, n, n, len, now_ns() - start);
+    free(lat);
+}
+
+/* bench_parse - parseline on typical lines and on pathological ones */
+static void bench_parse(void)
+{
+    static const char simple[] = "/bin/ls -l /usr/bin";
+    static const char typical[] =
+        "/bin/cat data.txt | /bin/grep -v '#' | /usr/bin/sort -u "
+        "> sorted.txt 2>&1 &";
+    char *line;
+    size_t len;
+
+    bench_parse1("parse_simple", simple, sizeof(simple) - 1, 100000 * scale);
+    bench_parse1("parse_typical", typical, sizeof(typical) - 1, 100000 * scale);
+
+    line = repeat("a ", 32768, "", &len);
+    bench_parse1("parse_words", line, len, 20 * scale);
+    free(line);
+
+    line = repeat("a | ", 4096, "a", &len);
+    bench_parse1("parse_stages", line, len, 20 * scale);
+    free(line);
+
+    line = repeat(">f ", 8192, "a", &len);
+    bench_parse1("parse_redirs", line, len, 20 * scale);
+    free(line);
+
+    line = repeat("x", 65536, "'", &len);
+    line[0] = '\'';
+    bench_parse1("parse_quoted", line, len, 20 * scale);
+    free(line);
+}
+
+/*
+ * storm - Start STORMKIDS background jobs that block on a pipe,
+ *    then close it so they all exit together. Returns the time
+ *    from release until every job has been reaped.
+ */
+static uint64_t storm(void)
+{
+    sigset_t mask, prev;
+    struct job_t *job;
+    int i, fds[2];
+    uint64_t start;
+    char c;
+    pid_t pid;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Pipe2(fds, O_CLOEXEC);
+
+    lockjobs(&mask, &prev);
+    for (i = 0; i < STORMKIDS; i++) {
+        if ((pid = Fork()) == CHILD) {
+            close(fds[1]);
+            read(fds[0], &c, 1);
+            _exit(0);
+        }
+        addjob(&jobs, pid, BG, "storm", 5);
+        if (evloop) {
+            job = getjobpid(&jobs, pid);
+            ev_watch(job);
+        }
+    }
+    close(fds[0]);
+
+    start = now_ns();
+    close(fds[1]);
+
+    while (jobs.npidents > 0) {
+        if (evloop) {
+            ev_wait(-1);
+        }
+        else {
+            Sigsuspend(&prev);
+        }
+    }
+    start = now_ns() - start;
+
+    unlockjobs(&prev);
+    return start;
+}
+
+/* bench_storm - Repeated SIGCHLD storms */
+static void bench_storm(void)
+{
+    int i, n = 2 * scale;
+    uint64_t *lat = xmalloc(n * sizeof(*lat));
+    uint64_t total = 0;
+
+    for (i = 0; i < n; i++) {
+        lat[i] = storm();
+        total += lat[i];
+    }
+    report("storm", lat, n, (unsigned long)n * STORMKIDS, 0, total);
+    free(lat);
+}
+
+int main(int argc, char **argv)
+{
+    int c, use_evloop = 0;
+
+    while ((c = getopt(argc, argv, "fzeq")) != EOF) {
+        switch (c) {
+            case 'f':
+                launch_mode = LAUNCH_FORK;
+                break;
+            case 'z':
+                launch_mode = LAUNCH_ZYGOTE;
+                break;
+            case 'e':
+                use_evloop = 1;
+                break;
+            case 'q':
+                scale = 1;
+                break;
+            default:
+                printf("usage: %s [-fze] [-q]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    if (launch_mode == LAUNCH_ZYGOTE) {
+        zy_init();
+    }
+    Signal(SIGCHLD, sigchld_handler);
+    initjobs(&jobs);
+    if (use_evloop) {
+        ev_init();
+    }
+
+    bench_eval();
+    bench_jobtable();
+    bench_parse();
+    bench_storm();
+    exit(0);
+}
@@ -0,0 +1,670 @@
+#include "header.h"
+#include <sys/stat.h>
+
+/*
+ * Builtin commands
+ *
+ * Every builtin is an entry in one table, found through a small
+ *    open addressed hash of the names (FNV-1a, as in path.c)
+ *    that is filled the first time a name is looked up. Each
+ *    builtin returns its exit status.
+ *
+ * Besides the job control builtins the shell runs a few of the
+ *    utilities scripts launch most often (echo, printf, test,
+ *    true, false, sleep) in-process. They are only used under
+ *    their bare names, so /bin/echo still runs the program,
+ *    and only for a foreground command on its own: in a
+ *    pipeline or with & the program is launched as before.
+ */
+
+#define BUILTINSLOTS 64             /* hash slots (power of 2) */
+
+struct builtin_t {                  /* A builtin command        */
+  const char *name;
+  int (*run)(struct cmdline_t *cmd);
+  int utility;                      /* also exists as a program */
+};
+
+/* bi_quit - quit: leave the shell */
+static int bi_quit(struct cmdline_t *cmd)
+{
+    exit(0);
+}
+
+/* bi_jobs - jobs [-l]: list the jobs */
+static int bi_jobs(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv;
+    sigset_t mask, prev;
+
+    Sigfillset(&mask);
+    lockjobs(&mask, &prev);
+    listjobs(&jobs, argv[1] != NULL && !strcmp(argv[1], "-l"));
+    unlockjobs(&prev);
+    return 0;
+}
+
+/* bi_bgfg - bg and fg */
+static int bi_bgfg(struct cmdline_t *cmd)
+{
+    return do_bgfg(cmd->argv);
+}
+
+/* bi_hash - hash */
+static int bi_hash(struct cmdline_t *cmd)
+{
+    return do_hash(cmd->argv);
+}
+
+/* bi_parallel - parallel */
+static int bi_parallel(struct cmdline_t *cmd)
+{
+    return do_parallel(cmd);
+}
+
+/* bi_trace - trace */
+static int bi_trace(struct cmdline_t *cmd)
+{
+    return do_trace(cmd->argv);
+}
+
+/* bi_cpu - cpu */
+static int bi_cpu(struct cmdline_t *cmd)
+{
+    return do_cpu(cmd->argv);
+}
+
+/* bi_ulimit - ulimit */
+static int bi_ulimit(struct cmdline_t *cmd)
+{
+    return do_ulimit(cmd->argv);
+}
+
+/* bi_wait - wait */
+static int bi_wait(struct cmdline_t *cmd)
+{
+    return do_wait(cmd->argv);
+}
+
+/* bi_export - export */
+static int bi_export(struct cmdline_t *cmd)
+{
+    return do_export(cmd->argv);
+}
+
+/* bi_unset - unset */
+static int bi_unset(struct cmdline_t *cmd)
+{
+    return do_unset(cmd->argv);
+}
+
+/* bi_history - history */
+static int bi_history(struct cmdline_t *cmd)
+{
+    return do_history(cmd->argv);
+}
+
+/* bi_true - true */
+static int bi_true(struct cmdline_t *cmd)
+{
+    return 0;
+}
+
+/* bi_false - false */
+static int bi_false(struct cmdline_t *cmd)
+{
+    return 1;
+}
+
+/*
+ * putescape - Print the escape sequence at s (just after the
+ *    backslash) and return the position after it. Octal escapes
+ *    are \0NNN for echo and %b, \NNN in a printf format. Sets
+ *    *stop for \c, which ends all output.
+ */
+static const char *putescape(const char *s, int format, int *stop)
+{
+    int c, i, max = 3;
+
+    switch (*s) {
+        case 'a': putchar('\a'); return s + 1;
+        case 'b': putchar('\b'); return s + 1;
+        case 'e': putchar('\033'); return s + 1;
+        case 'f': putchar('\f'); return s + 1;
+        case 'n': putchar('\n'); return s + 1;
+        case 'r': putchar('\r'); return s + 1;
+        case 't': putchar('\t'); return s + 1;
+        case 'v': putchar('\v'); return s + 1;
+        case '\\': putchar('\\'); return s + 1;
+        case 'c':
+            *stop = 1;
+            return s + 1;
+        case 'x':
+            if (!isxdigit((unsigned char)s[1])) {
+                break;
+            }
+            for (c = 0, i = 1; i <= 2 && isxdigit((unsigned char)s[i]); i++) {
+                c = c * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' :
+                              tolower((unsigned char)s[i]) - 'a' + 10);
+            }
+            putchar(c);
+            return s + i;
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7':
+            if (!format && *s != '0') {
+                break;
+            }
+            if (!format) {
+                s++;
+            }
+            for (c = 0, i = 0; i < max && s[i] >= '0' && s[i] <= '7'; i++) {
+                c = c * 8 + s[i] - '0';
+            }
+            putchar(c);
+            return s + i;
+    }
+    putchar('\\');
+    return s;
+}
+
+/* putescaped - Print s, expanding escapes; returns 1 after a \c */
+static int putescaped(const char *s)
+{
+    int stop = 0;
+
+    while (*s && !stop) {
+        if (*s == '\\' && s[1]) {
+            s = putescape(s + 1, 0, &stop);
+        }
+        else {
+            putchar(*s++);
+        }
+    }
+    return stop;
+}
+
+/*
+ * bi_echo - echo [-neE] [arg...]: print the arguments. -n drops
+ *    the newline and -e expands backslash escapes, as in bash.
+ */
+static int bi_echo(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv + 1;
+    int newline = 1, escapes = 0;
+    const char *p;
+
+    for (; *argv && (*argv)[0] == '-' && (*argv)[1]; argv++) {
+        for (p = *argv + 1; *p == 'n' || *p == 'e' || *p == 'E'; p++)
+            ;
+        if (*p) {
+            break;              /* not an option: print it */
+        }
+        for (p = *argv + 1; *p; p++) {
+            newline &= *p != 'n';
+            escapes = *p == 'e' ? 1 : *p == 'E' ? 0 : escapes;
+        }
+    }
+
+    for (; *argv; argv++) {
+        if (escapes) {
+            if (putescaped(*argv)) {
+                return 0;
+            }
+        }
+        else {
+            fputs(*argv, stdout);
+        }
+        if (argv[1]) {
+            putchar(' ');
+        }
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/*
+ * getnum - Read a printf integer argument: a number in C
+ *    syntax, or 'c for the code of the character c
+ */
+static long long getnum(const char *arg, int *status)
+{
+    long long n;
+    char *end;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    if (*arg == '\'' || *arg == '"') {
+        return (unsigned char)arg[1];
+    }
+    errno = 0;
+    n = strtoll(arg, &end, 0);
+    if (end == arg || *end || errno) {
+        printf("printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return n;
+}
+
+/*
+ * bi_printf - printf format [arg...]: print the arguments under
+ *    control of the format, which is reused until they are used
+ *    up. Supports the flags, width and precision of printf(3)
+ *    with d i o u x X c s e E f g G %, plus %b for an argument
+ *    with backslash escapes.
+ */
+static int bi_printf(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv, **arg, spec[32];
+    const char *fmt, *p, *start, *s;
+    int status = 0, stop = 0, len;
+
+    if (argv[1] == NULL) {
+        printf("printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    fmt = argv[1];
+    arg = &argv[2];
+
+    do {
+        for (p = fmt; *p && !stop; ) {
+            if (*p == '\\' && p[1]) {
+                p = putescape(p + 1, 1, &stop);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            /* Copy the flags, width and precision into spec */
+            start = p++;
+            p += strspn(p, "-+ #0");
+            p += strspn(p, "0123456789");
+            if (*p == '.') {
+                p++;
+                p += strspn(p, "0123456789");
+            }
+            len = p - start;
+            if (*p == '\0' || len > (int)sizeof(spec) - 4) {
+                printf("printf: %s: invalid format\n", start);
+                return 1;
+            }
+            memcpy(spec, start, len);
+
+            switch (*p) {
+                case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+                    spec[len++] = 'l';
+                    spec[len++] = 'l';
+                    spec[len++] = *p;
+                    spec[len] = '\0';
+                    printf(spec, getnum(*arg, &status));
+                    break;
+                case 'e': case 'E': case 'f': case 'g': case 'G':
+                    spec[len++] = *p;
+                    spec[len] = '\0';
+                    printf(spec, *arg ? strtod(*arg, NULL) : 0.0);
+                    break;
+                case 'c':
+                    spec[len++] = 'c';
+                    spec[len] = '\0';
+                    printf(spec, *arg ? (*arg)[0] : '\0');
+                    break;
+                case 's':
+                    spec[len++] = 's';
+                    spec[len] = '\0';
+                    printf(spec, *arg ? *arg : "");
+                    break;
+                case 'b':
+                    s = *arg ? *arg : "";
+                    stop = putescaped(s);
+                    break;
+                default:
+                    printf("printf: %%%c: invalid directive\n", *p);
+                    return 1;
+            }
+            if (*arg) {
+                arg++;
+            }
+            p++;
+        }
+    } while (*arg && arg != &argv[2] && !stop);
+
+    return status;
+}
+
+/* testint - Read an integer operand of test */
+static long long testint(const char *s, int *err)
+{
+    long long n;
+    char *end;
+
+    errno = 0;
+    n = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == s || *end || errno) {
+        printf("test: %s: integer expression expected\n", s);
+        *err = 1;
+    }
+    return n;
+}
+
+/* isunary - Is op a unary test operator? */
+static int isunary(const char *op)
+{
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghLnprsStuwxz", op[1]);
+}
+
+/* isbinary - Is op a binary test operator? */
+static int isbinary(const char *op)
+{
+    static const char *ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    int i;
+
+    for (i = 0; ops[i]; i++) {
+        if (!strcmp(op, ops[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* unary - Evaluate a unary test; returns 1 for true */
+static int unary(const char *op, const char *s)
+{
+    struct stat st;
+
+    switch (op[1]) {
+        case 'n': return *s != '\0';
+        case 'z': return *s == '\0';
+        case 't': return isatty(atoi(s));
+        case 'r': return access(s, R_OK) == 0;
+        case 'w': return access(s, W_OK) == 0;
+        case 'x': return access(s, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(s, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(s, &st) < 0) {
+        return 0;
+    }
+    switch (op[1]) {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'f': return S_ISREG(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+    return 1;                   /* -e */
+}
+
+/* binary - Evaluate a binary test; returns 1 for true */
+static int binary(const char *a, const char *op, const char *b, int *err)
+{
+    struct stat sa, sb;
+    long long x, y;
+    int ha, hb;
+
+    if (!strcmp(op, "=") || !strcmp(op, "==")) {
+        return !strcmp(a, b);
+    }
+    if (!strcmp(op, "!=")) {
+        return strcmp(a, b) != 0;
+    }
+    if (!strcmp(op, "<")) {
+        return strcmp(a, b) < 0;
+    }
+    if (!strcmp(op, ">")) {
+        return strcmp(a, b) > 0;
+    }
+    if (!strcmp(op, "-nt") || !strcmp(op, "-ot") || !strcmp(op, "-ef")) {
+        ha = stat(a, &sa) == 0;
+        hb = stat(b, &sb) == 0;
+        if (!strcmp(op, "-ef")) {
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        }
+        if (!strcmp(op, "-nt")) {
+            return ha && (!hb || sa.st_mtime > sb.st_mtime);
+        }
+        return hb && (!ha || sa.st_mtime < sb.st_mtime);
+    }
+
+    x = testint(a, err);
+    y = testint(b, err);
+    switch (op[1] * 256 + op[2]) {
+        case 'e' * 256 + 'q': return x == y;
+        case 'n' * 256 + 'e': return x != y;
+        case 'l' * 256 + 't': return x < y;
+        case 'l' * 256 + 'e': return x <= y;
+        case 'g' * 256 + 't': return x > y;
+    }
+    return x >= y;
+}
+
+/*
+ * testexpr - Evaluate the argc arguments of test by the POSIX
+ *    rules, which go by the number of arguments. Returns 1 for
+ *    true, 0 for false, -1 after printing an error.
+ */
+static int testexpr(char **argv, int argc)
+{
+    int err = 0, r;
+
+    switch (argc) {
+        case 0:
+            return 0;
+        case 1:
+            return argv[0][0] != '\0';
+        case 2:
+            if (!strcmp(argv[0], "!")) {
+                return !testexpr(argv + 1, 1);
+            }
+            if (isunary(argv[0])) {
+                return unary(argv[0], argv[1]);
+            }
+            printf("test: %s: unary operator expected\n", argv[0]);
+            return -1;
+        case 3:
+            if (isbinary(argv[1])) {
+                r = binary(argv[0], argv[1], argv[2], &err);
+                return err ? -1 : r;
+            }
+            if (!strcmp(argv[0], "!")) {
+                r = testexpr(argv + 1, 2);
+                return r < 0 ? r : !r;
+            }
+            if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")")) {
+                return testexpr(argv + 1, 1);
+            }
+            printf("test: %s: binary operator expected\n", argv[1]);
+            return -1;
+        case 4:
+            if (!strcmp(argv[0], "!")) {
+                r = testexpr(argv + 1, 3);
+                return r < 0 ? r : !r;
+            }
+            if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")")) {
+                return testexpr(argv + 1, 2);
+            }
+            break;
+    }
+    printf("test: too many arguments\n");
+    return -1;
+}
+
+/*
+ * bi_test - test expr, [ expr ]: exit 0 if expr is true, 1 if
+ *    it is false and 2 if it is malformed
+ */
+static int bi_test(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv;
+    int argc, r;
+
+    for (argc = 0; argv[argc + 1]; argc++)
+        ;
+    if (argv[0][0] == '[') {
+        if (argc == 0 || strcmp(argv[argc], "]")) {
+            printf("[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    r = testexpr(argv + 1, argc);
+    return r < 0 ? 2 : !r;
+}
+
+/*
+ * bi_sleep - sleep number[smhd]...: pause for the total of the
+ *    given times. The shell keeps reaping jobs meanwhile, and
+ *    ctrl-c ends the pause early.
+ */
+static int bi_sleep(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv;
+    struct timespec deadline;
+    double secs = 0, n;
+    int i;
+
+    if (argv[1] == NULL) {
+        printf("sleep: missing operand\n");
+        return 1;
+    }
+    for (i = 1; argv[i]; i++) {
+        if (parseduration(argv[i], &n) < 0) {
+            printf("sleep: invalid time interval '%s'\n", argv[i]);
+            return 1;
+        }
+        secs += n;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)secs;
+    deadline.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    return waitfor(NULL, NULL, &deadline) < 0 ? 128 + SIGINT : 0;
+}
+
+/* The builtins, job control first */
+static const struct builtin_t builtins[] = {
+    { "quit",     bi_quit,     0 },
+    { "jobs",     bi_jobs,     0 },
+    { "bg",       bi_bgfg,     0 },
+    { "fg",       bi_bgfg,     0 },
+    { "hash",     bi_hash,     0 },
+    { "parallel", bi_parallel, 0 },
+    { "trace",    bi_trace,    0 },
+    { "history",  bi_history,  0 },
+    { "cpu",      bi_cpu,      0 },
+    { "ulimit",   bi_ulimit,   0 },
+    { "wait",     bi_wait,     0 },
+    { "export",   bi_export,   0 },
+    { "unset",    bi_unset,    0 },
+    { "echo",     bi_echo,     1 },
+    { "printf",   bi_printf,   1 },
+    { "test",     bi_test,     1 },
+    { "[",        bi_test,     1 },
+    { "true",     bi_true,     1 },
+    { "false",    bi_false,    1 },
+    { "sleep",    bi_sleep,    1 },
+};
+
+static const struct builtin_t *slots[BUILTINSLOTS];
+
+/* namehash - FNV-1a hash of a builtin name */
+static unsigned namehash(const char *name)
+{
+    unsigned h = 2166136261u;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* findbuiltin - The builtin called name, or NULL */
+static const struct builtin_t *findbuiltin(const char *name)
+{
+    static int filled;
+    unsigned i;
+    size_t j;
+
+    if (!filled) {
+        for (j = 0; j < sizeof(builtins) / sizeof(*builtins); j++) {
+            i = namehash(builtins[j].name) & (BUILTINSLOTS - 1);
+            while (slots[i]) {
+                i = (i + 1) & (BUILTINSLOTS - 1);
+            }
+            slots[i] = &builtins[j];
+        }
+        filled = 1;
+    }
+
+    i = namehash(name) & (BUILTINSLOTS - 1);
+    while (slots[i] && strcmp(slots[i]->name, name)) {
+        i = (i + 1) & (BUILTINSLOTS - 1);
+    }
+    return slots[i];
+}
+
+/*
+ * cmdbuiltin - The builtin cmd's first word names, or NULL. The
+ *    answer is kept with the line when the word is one it was
+ *    parsed with.
+ */
+static const struct builtin_t *cmdbuiltin(struct cmdline_t *cmd)
+{
+    struct lookup_t *lk = &cmd->lookup[0];
+    const struct builtin_t *bi;
+
+    if (lk->biname == cmd->argv[0]) {
+        return lk->bi;
+    }
+    bi = findbuiltin(cmd->argv[0]);
+    if (lc_known(cmd, cmd->argv[0])) {
+        lk->biname = cmd->argv[0];
+        lk->bi = bi;
+    }
+    return bi;
+}
+
+/*
+ * isbuiltin - Should cmd, a single command, run in the shell?
+ *    The utilities only do in the foreground, and not under cpu,
+ *    ulimit or timeout, which need a process to act on.
+ */
+int isbuiltin(struct cmdline_t *cmd)
+{
+    const struct builtin_t *bi = cmdbuiltin(cmd);
+
+    return bi != NULL && !(bi->utility && (cmd->bg || cmd->pinned ||
+                           cmd->nlimits > 0 || cmd->timeout > 0));
+}
+
+/* builtin_cmd - Run the builtin cmd names and return its status */
+int builtin_cmd(struct cmdline_t *cmd)
+{
+    const struct builtin_t *bi = cmdbuiltin(cmd);
+
+    return bi ? bi->run(cmd) : 0;
+}
@@ -1,11 +1,13 @@
 #include "header.h"
 
 extern volatile sig_atomic_t atomic_fggpid;
+extern int laststatus;
 
 /*
- * do_bgfg - Execute the builtin bg and fg commands
+ * do_bgfg - Execute the builtin bg and fg commands. fg returns
+ *    the status of the job it waited for.
  */
-void do_bgfg(char **argv)
+int do_bgfg(char **argv)
 {
     char *cmd = argv[0], *opt = argv[1];
     int tofg, pid, jid, restart;
@@ -25,13 +27,13 @@ void do_bgfg(char **argv)
         if (!jid && !pid) {
             printf("%s: argument must be a PID or jobid\n",
                 (tofg ? "fg" : "bg"));
-            return;
+            return 1;
         }
     }
     else {
         printf("%s command requires PID or jobid argument\n",
             (tofg ? "fg" : "bg"));
-        return;
+        return 1;
     }
 
     /* By default, there is no valid job found */
@@ -39,7 +41,7 @@ void do_bgfg(char **argv)
 
     /* Asserts whether it is a valid PID */
     if (pid) {
-        job = getjobpid(jobs, pid);
+        job = getjobpid(&jobs, pid);
         if (!job) {
             printf("(%d): No such process\n", pid);
         }
@@ -50,14 +52,14 @@ void do_bgfg(char **argv)
         if (!jid) {
             printf("(%s): Invalid JID\n", opt+1);
         }
-        job = getjobjid(jobs, jid);
+        job = getjobjid(&jobs, jid);
         if (!job) {
             printf("(%d): No such job\n", jid);
         }
     }
 
     if (!job) {
-        return;
+        return 1;
     }
 
     /* Checks whether any additonal values were
@@ -67,12 +69,12 @@ void do_bgfg(char **argv)
     if (argv[2] != NULL) {
         printf("%s: Invalid option %s\n",
             (tofg ? "fg" : "bg"), argv[2]);
-        return;
+        return 1;
     }
 
-    /* Discovers whether the process needs
-     * to be awakended through sending it a
-     * SIGCONT signal.
+    /* Discovers whether the job needs
+     * to be awakended through sending its
+     * process group a SIGCONT signal.
      */
     restart = 1;
     if (job->state != ST) {
@@ -80,32 +82,137 @@ void do_bgfg(char **argv)
     }
 
     /* Update the state of the job */
-    job->state = (tofg ? FG : BG);
+    setjobstate(&jobs, job, (tofg ? FG : BG));
 
     if (tofg) {
         atomic_fggpid = job->pid;
 
         if (restart) {
-            Kill(job->pid, SIGCONT);
+            Kill(-job->pid, SIGCONT);
         }
-        waitfg(job->pid);
+        waitfg();
+        return laststatus;
     }
     else {
         if (restart) {
-            Kill(job->pid, SIGCONT);
+            Kill(-job->pid, SIGCONT);
         }
     }
+    return 0;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs)
+/*
+ * do_hash - Execute the builtin hash command
+ *
+ *    hash           list cached command locations
+ *    hash -r        forget every cached location
+ *    hash -s        show how well the parsed line cache does
+ *    hash name ...  search PATH for each name now
+ */
+int do_hash(char **argv)
+{
+    int i, status = 0;
+
+    if (argv[1] == NULL) {
+        listpaths();
+        return 0;
+    }
+
+    if (!strcmp(argv[1], "-r")) {
+        if (argv[2] != NULL) {
+            printf("hash: Invalid option %s\n", argv[2]);
+            return 1;
+        }
+        pathclear();
+        return 0;
+    }
+
+    if (!strcmp(argv[1], "-s")) {
+        if (argv[2] != NULL) {
+            printf("hash: Invalid option %s\n", argv[2]);
+            return 1;
+        }
+        lc_stats();
+        return 0;
+    }
+
+    for (i = 1; argv[i] != NULL; i++) {
+        if (pathlookup(argv[i]) == NULL) {
+            printf("hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * printtime - Report the wall clock time from start to end and
+ *    the resource usage ru, in the format of bash's `time`
+ *    followed by peak RSS and context switches. Called from
+ *    reapchild, so the report is queued with notify.
+ */
+void printtime(const struct timespec *start, const struct timespec *end,
+               const struct rusage *ru)
 {
+    long sec = end->tv_sec - start->tv_sec;
+    long nsec = end->tv_nsec - start->tv_nsec;
+
+    if (nsec < 0) {
+        sec--;
+        nsec += 1000000000;
+    }
+    notify("\nreal\t%ldm%ld.%03lds\n", sec / 60, sec % 60, nsec / 1000000);
+    notify("user\t%ldm%ld.%03lds\n", (long)ru->ru_utime.tv_sec / 60,
+        (long)ru->ru_utime.tv_sec % 60, (long)ru->ru_utime.tv_usec / 1000);
+    notify("sys\t%ldm%ld.%03lds\n", (long)ru->ru_stime.tv_sec / 60,
+        (long)ru->ru_stime.tv_sec % 60, (long)ru->ru_stime.tv_usec / 1000);
+    notify("maxrss\t%ldK\n", ru->ru_maxrss);
+    notify("csw\t%ld/%ld\n", ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/*
+ * printstats - Print the second line of `jobs -l`: when the job
+ *    started, how long it has run, the resources used by the
+ *    members reaped so far and the CPUs it was placed on
+ */
+static void printstats(struct job_t *job)
+{
+    const struct rusage *ru = &job->stats.usage;
+    struct timespec now;
+    struct tm tm;
+    char cpus[MAXLINE] = "any";
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (now.tv_sec - job->stats.start.tv_sec) * 1000 +
+         (now.tv_nsec - job->stats.start.tv_nsec) / 1000000;
+    localtime_r(&job->stats.started, &tm);
+    if (job->pinned) {
+        cpu_format(&job->cpus, cpus, sizeof(cpus));
+    }
+
+    printf("    started %02d:%02d:%02d elapsed %ld.%03lds "
+           "user %ld.%03lds sys %ld.%03lds maxrss %ldK csw %ld/%ld cpus %s\n",
+        tm.tm_hour, tm.tm_min, tm.tm_sec, ms / 1000, ms % 1000,
+        (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec / 1000,
+        (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec / 1000,
+        ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, cpus);
+}
+
+/*
+ * listjobs - Print the job list. With full set (`jobs -l`) each
+ *    job is followed by its start time and resource usage.
+ */
+void listjobs(struct joblist_t *jobs, int full)
+{
+    struct job_t *job;
     int i;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid != 0) {
-            printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-            switch (jobs[i].state) {
+    for (i = 0; i < jobs->size; i++) {
+        job = &jobs->slots[i];
+        if (job->pid != 0) {
+            printf("[%d] (%d) ", job->jid, job->pid);
+            switch (job->state) {
                 case BG:
                     printf("Running ");
                     break;
@@ -117,9 +224,12 @@ void listjobs(struct job_t *jobs)
                     break;
                 default:
                     printf("listjobs: Internal error: job[%d].state=%d ",
-                        i, jobs[i].state);
+                        i, job->state);
+            }
+            printf("%s\n", job->cmdline);
+            if (full) {
+                printstats(job);
             }
-            printf("%s", jobs[i].cmdline);
         }
     }
 }
@@ -129,10 +239,14 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void)
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvplfez] [-c command | script]\n");
     printf("   -h  print this message\n");
     printf("   -v  print additional diagnostic information\n");
     printf("   -p  do not emit a command prompt\n");
-    printf("   -l  emit logging statements to console\n");
+    printf("   -l  trace job events and print them on exit\n");
+    printf("   -f  launch commands with fork/execve instead of posix_spawn\n");
+    printf("   -z  launch commands from a pre-forked zygote process\n");
+    printf("   -e  wait for input, signals and jobs on an epoll event loop\n");
+    printf("   -c  run the commands in the given string, then exit\n");
     exit(1);
 }
@@ -0,0 +1,254 @@
+#include "header.h"
+
+/*
+ * CPU placement
+ *
+ * A job normally runs wherever the shell may run. `cpu LIST cmd`
+ *    confines one job to the CPUs in LIST (e.g. 2-5,8), and
+ *    `cpu spread` gives every background job that was not placed
+ *    by hand a part of the machine of its own: a single CPU, or
+ *    a NUMA node's CPUs, taken in round-robin order or the one
+ *    holding the fewest of the shell's placed jobs. Every
+ *    process of the job gets the same mask, which the launch
+ *    path applies in the child before it execs.
+ *
+ * The units handed out are the CPUs (or node CPUs) the shell
+ *    itself may use, as they were when spreading was turned on.
+ */
+
+#define SPREAD_OFF   0          /* inherit the shell's mask       */
+#define SPREAD_RR    1          /* next unit in turn              */
+#define SPREAD_LEAST 2          /* unit with the fewest jobs      */
+
+#define NODEDIR "/sys/devices/system/node"
+
+static int spread = SPREAD_OFF;
+static int bynode;              /* units are NUMA nodes, not CPUs */
+static cpu_set_t *units;        /* what spreading hands out       */
+static int nunits;
+static int nextunit;            /* round robin position           */
+
+/*
+ * cpu_parse - Parse a CPU list such as 0-3,8 into *set.
+ *    Returns -1 if s is not a list.
+ */
+int cpu_parse(const char *s, cpu_set_t *set)
+{
+    long lo, hi;
+    char *end;
+
+    CPU_ZERO(set);
+    do {
+        if (!isdigit((unsigned char)*s)) {
+            return -1;
+        }
+        lo = hi = strtol(s, &end, 10);
+        if (*end == '-') {
+            s = end + 1;
+            if (!isdigit((unsigned char)*s)) {
+                return -1;
+            }
+            hi = strtol(s, &end, 10);
+        }
+        if (lo > hi || hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (; lo <= hi; lo++) {
+            CPU_SET(lo, set);
+        }
+        s = end;
+    } while (*s++ == ',');
+
+    return s[-1] == '\0' ? 0 : -1;
+}
+
+/* cpu_format - Write set to buf as a CPU list */
+void cpu_format(const cpu_set_t *set, char *buf, size_t size)
+{
+    size_t len = 0;
+    int i, j;
+
+    buf[0] = '\0';
+    for (i = 0; i < CPU_SETSIZE && len < size; i = j) {
+        if (!CPU_ISSET(i, set)) {
+            j = i + 1;
+            continue;
+        }
+        for (j = i + 1; j < CPU_SETSIZE && CPU_ISSET(j, set); j++)
+            ;
+        len += snprintf(buf + len, size - len, j - 1 > i ? "%s%d-%d" : "%s%d",
+                        len ? "," : "", i, j - 1);
+    }
+}
+
+/*
+ * cpu_check - Can the shell place a job on set? Prints an error
+ *    naming s and returns -1 if not.
+ */
+int cpu_check(const char *s, const cpu_set_t *set)
+{
+    cpu_set_t allowed, both;
+
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    CPU_AND(&both, set, &allowed);
+    if (!CPU_EQUAL(&both, set)) {
+        printf("cpu: %s: CPUs not available\n", s);
+        return -1;
+    }
+    return 0;
+}
+
+/* addunit - Hand out set, if it has any of the allowed CPUs */
+static void addunit(const cpu_set_t *set, const cpu_set_t *allowed)
+{
+    cpu_set_t *u;
+
+    if ((u = realloc(units, (nunits + 1) * sizeof(*units))) == NULL) {
+        unix_error("cpu error");
+    }
+    units = u;
+    CPU_AND(&units[nunits], set, allowed);
+    if (CPU_COUNT(&units[nunits]) > 0) {
+        nunits++;
+    }
+}
+
+/*
+ * findunits - List the units to spread jobs over: each allowed
+ *    CPU, or each NUMA node's allowed CPUs. A machine without
+ *    node information is one node.
+ */
+static void findunits(void)
+{
+    cpu_set_t allowed, set;
+    char path[MAXLINE], list[MAXLINE];
+    FILE *fp;
+    int i;
+
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    nunits = nextunit = 0;
+
+    for (i = 0; bynode; i++) {
+        snprintf(path, sizeof(path), NODEDIR "/node%d/cpulist", i);
+        if ((fp = fopen(path, "re")) == NULL) {
+            break;
+        }
+        if (fgets(list, sizeof(list), fp) != NULL) {
+            list[strcspn(list, "\n")] = '\0';
+            if (cpu_parse(list, &set) == 0) {
+                addunit(&set, &allowed);
+            }
+        }
+        fclose(fp);
+    }
+    if (bynode) {
+        if (nunits == 0) {
+            addunit(&allowed, &allowed);
+        }
+        return;
+    }
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &allowed)) {
+            CPU_ZERO(&set);
+            CPU_SET(i, &set);
+            addunit(&set, &allowed);
+        }
+    }
+}
+
+/* unitload - Number of live jobs placed on unit u */
+static int unitload(int u)
+{
+    struct job_t *job;
+    cpu_set_t both;
+    int i, n = 0;
+
+    for (i = 0; i < jobs.size; i++) {
+        job = &jobs.slots[i];
+        if (job->pid != 0 && job->pinned) {
+            CPU_AND(&both, &job->cpus, &units[u]);
+            n += CPU_COUNT(&both) > 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * cpu_place - Decide where the job cmd describes runs: on the
+ *    CPUs given with `cpu`, if any, or for a background job on
+ *    the next unit when spreading. Sets cmd->pinned if the job
+ *    gets a mask of its own in cmd->cpus. The caller holds the
+ *    job list locked.
+ */
+void cpu_place(struct cmdline_t *cmd)
+{
+    int i, u, best, load;
+
+    if (cmd->pinned || !cmd->bg || spread == SPREAD_OFF || nunits == 0) {
+        return;
+    }
+
+    u = nextunit;
+    if (spread == SPREAD_LEAST) {
+        /* Ties go to the first unit after the last one used */
+        for (i = 0, best = -1; i < nunits; i++) {
+            load = unitload((nextunit + i) % nunits);
+            if (best < 0 || load < best) {
+                best = load;
+                u = (nextunit + i) % nunits;
+            }
+        }
+    }
+    nextunit = (u + 1) % nunits;
+
+    cmd->cpus = units[u];
+    cmd->pinned = 1;
+}
+
+/*
+ * do_cpu - Execute the builtin cpu command (`cpu LIST cmd` is
+ *    taken off the command line by eval)
+ *
+ *    cpu                         show the spreading mode and units
+ *    cpu spread rr|least [node]  spread background jobs over CPUs,
+ *                                or over NUMA nodes
+ *    cpu spread off              let jobs inherit the shell's mask
+ */
+int do_cpu(char **argv)
+{
+    static const char *modes[] = { "off", "rr", "least" };
+    char buf[MAXLINE];
+    int i;
+
+    if (argv[1] == NULL) {
+        printf("cpu: spread %s%s\n", modes[spread],
+            spread != SPREAD_OFF && bynode ? " node" : "");
+        for (i = 0; spread != SPREAD_OFF && i < nunits; i++) {
+            cpu_format(&units[i], buf, sizeof(buf));
+            printf("    %s\n", buf);
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "spread") || argv[2] == NULL ||
+        (argv[3] && (strcmp(argv[3], "node") || argv[4]))) {
+        printf("cpu: usage: cpu [LIST command | spread rr|least|off [node]]\n");
+        return 1;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (!strcmp(argv[2], modes[i])) {
+            break;
+        }
+    }
+    if (i == 3) {
+        printf("cpu: %s: unknown mode\n", argv[2]);
+        return 1;
+    }
+    spread = i;
+    bynode = argv[3] != NULL;
+    if (spread != SPREAD_OFF) {
+        findunits();
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include "header.h"
+
+/*
+ * Shell variables and the environment
+ *
+ * Every variable is one "NAME=value" string in an open addressed
+ *    table (FNV-1a with linear probing, as in path.c). Exported
+ *    variables also own a slot in envp, the NULL terminated
+ *    array handed to every launch, so setting one replaces a
+ *    single pointer, a new one is appended and an unset one is
+ *    swapped with the last. envp is never rebuilt whole, and
+ *    environ is kept pointing at it so getenv sees the changes.
+ *
+ * `VAR=val cmd` does not touch the store: the assignments are
+ *    laid over a copy of envp's pointers for that command only.
+ *
+ * The store is filled from the environment the shell started
+ *    with the first time it is used. It is changed with every
+ *    signal blocked, since parallel starts instances from the
+ *    SIGCHLD handler with environ.
+ */
+
+extern char **environ;
+
+#define MINVARS 64                  /* initial size of the table */
+
+struct var_t {                      /* A shell variable          */
+  char *str;                        /* NAME=value, or NAME if an */
+  size_t namelen;                   /*   exported one is unset   */
+  int exported;                     /* passed to commands        */
+  int slot;                         /* its envp index, or -1     */
+};
+
+static struct var_t *table;         /* open addressed slots      */
+static size_t nslots;               /* size of table (power of 2)*/
+static size_t nused;                /* occupied slots            */
+static char **envp;                 /* exported NAME=value       */
+static int nenv, envcap;
+static char **block;                /* envp with a command's own */
+static int blockcap;                /*   assignments laid over   */
+
+/* varhash - FNV-1a hash of the len-byte name at s */
+static size_t varhash(const char *s, size_t len)
+{
+    size_t h = 2166136261u;
+
+    while (len-- > 0) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * findvar - Slot holding the variable named by the len bytes at
+ *    s, or the empty slot it belongs in
+ */
+static struct var_t *findvar(const char *s, size_t len)
+{
+    size_t i = varhash(s, len) & (nslots - 1);
+
+    while (table[i].str && (table[i].namelen != len ||
+                            memcmp(table[i].str, s, len))) {
+        i = (i + 1) & (nslots - 1);
+    }
+    return &table[i];
+}
+
+/* growvars - Double the table and rehash every variable */
+static void growvars(void)
+{
+    struct var_t *old = table;
+    size_t i, oldslots = nslots;
+
+    nslots = oldslots ? oldslots * 2 : MINVARS;
+    if ((table = calloc(nslots, sizeof(*table))) == NULL) {
+        unix_error("growvars error");
+    }
+    for (i = 0; i < oldslots; i++) {
+        if (old[i].str) {
+            *findvar(old[i].str, old[i].namelen) = old[i];
+        }
+    }
+    free(old);
+}
+
+/* addenv - Give v a slot at the end of envp */
+static void addenv(struct var_t *v)
+{
+    char **e;
+
+    if (nenv + 2 > envcap) {
+        envcap = envcap ? envcap * 2 : MINVARS;
+        if ((e = realloc(envp, envcap * sizeof(*envp))) == NULL) {
+            unix_error("environment error");
+        }
+        envp = environ = e;
+    }
+    v->slot = nenv;
+    envp[nenv++] = v->str;
+    envp[nenv] = NULL;
+}
+
+/* dropenv - Take v's string out of envp, moving the last into its slot */
+static void dropenv(struct var_t *v)
+{
+    const char *last;
+
+    if (v->slot < 0) {
+        return;
+    }
+    last = envp[--nenv];
+    if (v->slot < nenv) {
+        envp[v->slot] = (char *)last;
+        findvar(last, strcspn(last, "="))->slot = v->slot;
+    }
+    envp[nenv] = NULL;
+    v->slot = -1;
+}
+
+/* ispath - Is the namelen-byte name at s PATH, which commands are found on? */
+static int ispath(const char *s, size_t namelen)
+{
+    return namelen == 4 && !strncmp(s, "PATH", 4);
+}
+
+/* setvar - Store the len bytes at s (NAME=value or NAME) as a variable */
+static struct var_t *setvar(const char *s, size_t len, int export)
+{
+    struct var_t *v;
+    size_t namelen = strcspn(s, "=");
+    char *str;
+
+    if ((str = malloc(len + 1)) == NULL) {
+        unix_error("environment error");
+    }
+    memcpy(str, s, len);
+    str[len] = '\0';
+
+    if ((nused + 1) * 4 > nslots * 3) {
+        growvars();
+    }
+    v = findvar(s, namelen);
+    if (v->str == NULL) {
+        v->namelen = namelen;
+        v->exported = 0;
+        v->slot = -1;
+        nused++;
+    }
+    free(v->str);
+    v->str = str;
+    v->exported |= export;
+
+    if (v->slot >= 0) {
+        envp[v->slot] = str;
+    }
+    else if (v->exported && namelen < len) {
+        addenv(v);
+    }
+    if (ispath(s, namelen)) {
+        pathclear();            /* lookups kept with lines are stale */
+    }
+    return v;
+}
+
+/* load - Fill the store from the shell's environment, once */
+static void load(void)
+{
+    char **e = environ;
+
+    if (table) {
+        return;
+    }
+    growvars();
+    envcap = MINVARS;
+    if ((envp = malloc(envcap * sizeof(*envp))) == NULL) {
+        unix_error("environment error");
+    }
+    envp[0] = NULL;
+    for (; e && *e; e++) {
+        if (env_isassign(*e)) {
+            setvar(*e, strlen(*e), 1);
+        }
+    }
+    environ = envp;
+}
+
+/* delvar - Forget v, reinserting the rest of its probe chain */
+static void delvar(struct var_t *v)
+{
+    struct var_t moved;
+    size_t i;
+
+    if (ispath(v->str, v->namelen)) {
+        pathclear();
+    }
+    dropenv(v);
+    free(v->str);
+    v->str = NULL;
+    nused--;
+
+    i = ((v - table) + 1) & (nslots - 1);
+    while (table[i].str) {
+        moved = table[i];
+        table[i].str = NULL;
+        *findvar(moved.str, moved.namelen) = moved;
+        i = (i + 1) & (nslots - 1);
+    }
+}
+
+/*
+ * env_namelen - Length of the variable name (a letter or _, then
+ *    letters, digits and _) that s starts with, 0 if none
+ */
+size_t env_namelen(const char *s)
+{
+    size_t n = 0;
+
+    if (isalpha((unsigned char)*s) || *s == '_') {
+        for (n = 1; isalnum((unsigned char)s[n]) || s[n] == '_'; n++)
+            ;
+    }
+    return n;
+}
+
+/* env_isassign - Is word an assignment, NAME=value? */
+int env_isassign(const char *word)
+{
+    size_t n = env_namelen(word);
+
+    return n > 0 && word[n] == '=';
+}
+
+/*
+ * env_get - Value of the variable named by the len bytes at
+ *    name, or NULL if it is unset
+ */
+const char *env_get(const char *name, size_t len)
+{
+    struct var_t *v;
+
+    load();
+    v = findvar(name, len);
+    return v->str && v->str[v->namelen] ? v->str + v->namelen + 1 : NULL;
+}
+
+/*
+ * env_assign - Set a variable from word, NAME=value. It is
+ *    exported if export is set or it already was.
+ */
+void env_assign(const char *word, int export)
+{
+    sigset_t mask, prev;
+
+    load();
+    Sigfillset(&mask);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    setvar(word, strlen(word), export);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ * env_block - The environment for a command given the n
+ *    assignments (NAME=value words) in assigns: envp itself if
+ *    there are none, or else a copy of its pointers with the
+ *    assignments laid over it, valid until the next call
+ */
+char **env_block(char **assigns, int n)
+{
+    struct var_t *v;
+    size_t len;
+    char **b;
+    int i, j, nb;
+
+    load();
+    if (n == 0) {
+        return envp;
+    }
+    if (nenv + n + 1 > blockcap) {
+        blockcap = nenv + n + 1;
+        if ((b = realloc(block, blockcap * sizeof(*block))) == NULL) {
+            unix_error("environment error");
+        }
+        block = b;
+    }
+    memcpy(block, envp, nenv * sizeof(*block));
+
+    for (i = 0, nb = nenv; i < n; i++) {
+        len = env_namelen(assigns[i]) + 1;          /* with the = */
+        v = findvar(assigns[i], len - 1);
+        if (v->str && v->slot >= 0) {
+            block[v->slot] = assigns[i];
+            continue;
+        }
+        for (j = nenv; j < nb && strncmp(block[j], assigns[i], len); j++)
+            ;
+        block[j] = assigns[i];
+        nb += j == nb;
+    }
+    block[nb] = NULL;
+    return block;
+}
+
+/*
+ * do_export - Execute the builtin export command
+ *
+ *    export                  list the exported variables
+ *    export NAME[=value]...  export each NAME, setting it first
+ *                            if a value is given
+ */
+int do_export(char **argv)
+{
+    struct var_t *v;
+    sigset_t mask, prev;
+    size_t n;
+    int i, status = 0;
+
+    load();
+    if (argv[1] == NULL) {
+        for (i = 0; i < nenv; i++) {
+            printf("export %s\n", envp[i]);
+        }
+        return 0;
+    }
+
+    Sigfillset(&mask);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 1; argv[i]; i++) {
+        n = env_namelen(argv[i]);
+        if (n == 0 || (argv[i][n] && argv[i][n] != '=')) {
+            printf("export: %s: not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        v = findvar(argv[i], n);
+        if (argv[i][n] == '=' || v->str == NULL) {
+            setvar(argv[i], strlen(argv[i]), 1);
+        }
+        else if (!v->exported) {
+            v->exported = 1;
+            if (v->str[n]) {
+                addenv(v);
+            }
+        }
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    return status;
+}
+
+/*
+ * do_unset - Execute the builtin unset command
+ *
+ *    unset NAME...   remove each variable, from the environment
+ *                    of later commands too
+ */
+int do_unset(char **argv)
+{
+    struct var_t *v;
+    sigset_t mask, prev;
+    size_t n;
+    int i, status = 0;
+
+    load();
+    Sigfillset(&mask);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 1; argv[i]; i++) {
+        n = env_namelen(argv[i]);
+        if (n == 0 || argv[i][n]) {
+            printf("unset: %s: not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        if ((v = findvar(argv[i], n))->str) {
+            delvar(v);
+        }
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    return status;
+}
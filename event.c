@@ -0,0 +1,302 @@
+#include "header.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/pidfd.h>
+#include <sys/syscall.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3                   /* waitid on a pidfd (Linux 5.4) */
+#endif
+
+/*
+ * Event loop core (mpsh -e)
+ *
+ * SIGCHLD, SIGINT, SIGTSTP and SIGALRM stay blocked for the life of the
+ *    shell and are read from a signalfd instead, and every job
+ *    leader is watched through a pidfd. The signalfd and the
+ *    pidfds live on their own epoll set, which is nested in the
+ *    main set next to stdin: the read loop waits on both at once,
+ *    while waitfg waits on the job set alone so typed-ahead input
+ *    stays queued until the foreground job is done.
+ *
+ * All reaping happens here in normal context, so the job table
+ *    never needs signals blocked around it and never holds a PID
+ *    that has already been reaped and could be reused.
+ */
+
+#define MAXEVENTS 64                /* events taken per epoll_wait */
+#define SIGDATA   0                 /* epoll data for the signalfd */
+
+extern char promt[];
+extern volatile sig_atomic_t atomic_fggpid;
+extern volatile sig_atomic_t atomic_intr;
+extern int laststatus;
+
+char evloop = 0;                    /* if true, use the event loop  */
+sigset_t origmask;                  /* signal mask children inherit */
+
+static int mainfd = -1;             /* epoll set: stdin + jobfd     */
+static int jobfd = -1;              /* epoll set: signalfd + pidfds */
+static int sigfd = -1;              /* SIGCHLD, SIGINT, SIGTSTP...  */
+
+/*
+ * lockjobs - Block the signals in mask before touching the job
+ *    table, saving the mask to restore in prev (if not NULL).
+ *    In the event loop those signals never interrupt anything,
+ *    so this only reports the mask that children should start
+ *    with.
+ */
+void lockjobs(const sigset_t *mask, sigset_t *prev)
+{
+    if (evloop) {
+        if (prev) {
+            *prev = origmask;
+        }
+        return;
+    }
+    Sigprocmask(SIG_BLOCK, mask, prev);
+}
+
+/* unlockjobs - Restore the mask saved by lockjobs */
+void unlockjobs(const sigset_t *prev)
+{
+    if (!evloop) {
+        Sigprocmask(SIG_SETMASK, prev, NULL);
+    }
+}
+
+/* addwatch - Add fd to an epoll set for input */
+static void addwatch(int epfd, int fd, uint64_t data)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = data;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+}
+
+/*
+ * ev_watch - Watch a new job's leader through a pidfd. The pid
+ *    is the epoll data, so an event for a job that was already
+ *    reaped through SIGCHLD finds nothing and is dropped. If no
+ *    pidfd can be had (an old kernel, or out of descriptors) the
+ *    job is left to SIGCHLD, which reaps every child anyway; the
+ *    first such failure, unless pidfds are missing altogether,
+ *    is reported once.
+ */
+void ev_watch(struct job_t *job)
+{
+    static int warned;
+
+    if ((job->pidfd = pidfd_open(job->pid, 0)) < 0) {
+        if (errno != ENOSYS && !warned) {
+            printf("pidfd_open: %s\n", strerror(errno));
+            warned = 1;
+        }
+        return;
+    }
+    addwatch(jobfd, job->pidfd, (uint64_t)job->pid);
+}
+
+/* ev_unwatch - Stop watching a job that is about to be deleted */
+void ev_unwatch(struct job_t *job)
+{
+    if (job->pidfd >= 0) {
+        close(job->pidfd);      /* also drops it from jobfd */
+        job->pidfd = -1;
+    }
+}
+
+/* reapall - Collect every child with a status change */
+static void reapall(void)
+{
+    struct rusage ru;
+    int status;
+    pid_t pid;
+
+    while ((pid = batchwait(&status, &ru)) > 0) {
+        reapchild(pid, status, &ru);
+    }
+    if (pid < 0 && errno != ECHILD) {
+        unix_error("waitpid error");
+    }
+}
+
+/* reappidfd - Reap the leader of a job whose pidfd became readable */
+static void reappidfd(pid_t pid)
+{
+    struct job_t *job = getjobpid(&jobs, pid);
+    struct rusage ru;
+    siginfo_t info;
+    int status;
+
+    if (job == NULL || job->pidfd < 0) {
+        return;
+    }
+
+    /* The raw system call also reports the child's rusage */
+    info.si_pid = 0;
+    if (syscall(SYS_waitid, P_PIDFD, job->pidfd, &info,
+                WEXITED | WNOHANG, &ru) < 0) {
+        if (errno == ECHILD) {
+            return;
+        }
+        unix_error("waitid error");
+    }
+    if (info.si_pid == 0) {
+        return;
+    }
+
+    /* Rebuild the status word waitpid would have returned */
+    if (info.si_code == CLD_EXITED) {
+        status = (info.si_status & 0xff) << 8;
+    }
+    else {
+        status = (info.si_status & 0x7f) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+    }
+    reapchild(pid, status, &ru);
+}
+
+/* readsignals - Drain the signalfd */
+static void readsignals(void)
+{
+    struct signalfd_siginfo si;
+
+    while (read(sigfd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+            case SIGCHLD:
+                reapall();
+                break;
+            case SIGALRM:
+                tm_expire();
+                break;
+            case SIGINT:
+            case SIGTSTP:
+                /* Forward ctrl-c and ctrl-z to the foreground job */
+                if (atomic_fggpid) {
+                    Kill(-atomic_fggpid, si.ssi_signo);
+                }
+                else if (si.ssi_signo == SIGINT) {
+                    atomic_intr = 1;    /* interrupts a builtin */
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * ev_wait - Wait up to timeout ms (-1 for no limit) for one
+ *    round of job events and handle them. The caller loops
+ *    until whatever it is waiting for has happened.
+ */
+void ev_wait(int timeout)
+{
+    struct epoll_event events[MAXEVENTS];
+    int i, n;
+
+    Trace(TR_EVWAIT, 0, 0, 0);
+
+    if ((n = epoll_wait(jobfd, events, MAXEVENTS, timeout)) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        unix_error("epoll_wait error");
+    }
+
+    for (i = 0; i < n; i++) {
+        if (events[i].data.u64 == SIGDATA) {
+            readsignals();
+        }
+        else {
+            reappidfd((pid_t)events[i].data.u64);
+        }
+    }
+
+    Trace(TR_EVWAIT, 1, 0, 0);
+}
+
+/* ev_init - Move job signals onto a signalfd and build the epoll sets */
+void ev_init(void)
+{
+    sigset_t mask;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGTSTP);
+    Sigaddset(&mask, SIGALRM);
+    Sigprocmask(SIG_BLOCK, &mask, &origmask);
+
+    if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        unix_error("signalfd error");
+    }
+    if ((jobfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (mainfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+
+    addwatch(jobfd, sigfd, SIGDATA);
+    addwatch(mainfd, jobfd, 0);
+
+    evloop = 1;
+}
+
+/*
+ * ev_run - The shell's read/eval loop when running on the event
+ *    loop. Input is read from rd as it arrives and evaluated a
+ *    line at a time; job events are handled while waiting for
+ *    more. Input that cannot be polled (a mapped script, a
+ *    regular file on stdin) is always ready, so pending job
+ *    events are only checked for between lines.
+ */
+void ev_run(struct reader_t *rd, int emit_prompt)
+{
+    struct epoll_event ev, events[2];
+    int i, nev, pollable = 0;
+    size_t len;
+    char *line;
+
+    if (rd->fd >= 0 && !rd->eof) {
+        ev.events = EPOLLIN;
+        ev.data.u64 = 1;
+        if (epoll_ctl(mainfd, EPOLL_CTL_ADD, rd->fd, &ev) == 0) {
+            pollable = 1;
+        }
+        else if (errno != EPERM) {
+            unix_error("epoll_ctl error");
+        }
+    }
+
+    while (TRUE) {
+
+        out_prompt(emit_prompt ? fl_prompt(promt) : NULL);
+
+        /* Wait for a complete line, handling job events meanwhile */
+        if (!pollable) {
+            ev_wait(0);
+        }
+        while (pollable && !rd_ready(rd)) {
+            if ((nev = epoll_wait(mainfd, events, 2, -1)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                unix_error("epoll_wait error");
+            }
+            for (i = 0; i < nev; i++) {
+                if (events[i].data.u64 == 0) {
+                    ev_wait(-1);
+                }
+                else {
+                    rd_fill(rd);
+                }
+            }
+        }
+
+        if ((line = rd_line(rd, &len)) == NULL) {    /* End of file (ctrl-d) */
+            exit(fl_end());
+        }
+        fl_eval(line, len);
+    }
+}
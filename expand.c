@@ -0,0 +1,151 @@
+#include "header.h"
+
+extern int laststatus;
+
+/*
+ * Parameter expansion
+ *
+ * parseline compiles each unquoted word holding a $ into a
+ *    template: the word split into literal text and parameters
+ *    ($NAME, ${NAME}, $? and $$). Expanding a line then only
+ *    walks its templates, looking each parameter up once, and
+ *    never scans the words again. The values are not split
+ *    into more words, and a word in single quotes is never
+ *    expanded.
+ *
+ * Expanded words are written to an arena of their own, reused
+ *    by the next line, and the template's argv or redirection
+ *    slot is pointed at the result. The template is left as it
+ *    was, so the same parsed line can be expanded again.
+ */
+
+/* Segment kinds */
+#define SEG_TEXT   0            /* literal text           */
+#define SEG_VAR    1            /* $NAME or ${NAME}       */
+#define SEG_STATUS 2            /* $?                     */
+#define SEG_PID    3            /* $$                     */
+
+/* addseg - Append a segment to the template being compiled */
+static void addseg(struct cmdline_t *cmd, int kind, const char *s, size_t len)
+{
+    struct seg_t *seg = &cmd->seg[cmd->nsegs++];
+
+    seg->kind = kind;
+    seg->s = s;
+    seg->len = len;
+}
+
+/*
+ * ex_compile - Compile the word in *slot, part of cmd, into a
+ *    template if it holds any parameters. A $ that does not
+ *    start one is kept as it is.
+ */
+void ex_compile(struct cmdline_t *cmd, char **slot)
+{
+    const char *p = *slot, *text = p, *name;
+    int first = cmd->nsegs, nparams = 0;
+    size_t n, skip;
+
+    while ((p = strchr(p, '$')) != NULL) {
+        name = p + 1;
+        if (*name == '?' || *name == '$') {
+            n = 0;
+            skip = 2;
+        }
+        else if (*name == '{') {
+            if ((n = env_namelen(++name)) == 0 || name[n] != '}') {
+                p++;
+                continue;
+            }
+            skip = n + 3;
+        }
+        else if ((n = env_namelen(name)) > 0) {
+            skip = n + 1;
+        }
+        else {
+            p++;
+            continue;
+        }
+
+        if (p > text) {
+            addseg(cmd, SEG_TEXT, text, p - text);
+        }
+        if (n == 0) {
+            addseg(cmd, p[1] == '?' ? SEG_STATUS : SEG_PID, NULL, 0);
+        }
+        else {
+            addseg(cmd, SEG_VAR, name, n);
+        }
+        nparams++;
+        p += skip;
+        text = p;
+    }
+
+    if (nparams == 0) {
+        cmd->nsegs = first;
+        return;
+    }
+    if (*text) {
+        addseg(cmd, SEG_TEXT, text, strlen(text));
+    }
+    cmd->tmpl[cmd->ntmpls].slot = slot;
+    cmd->tmpl[cmd->ntmpls].seg = &cmd->seg[first];
+    cmd->tmpl[cmd->ntmpls++].nsegs = cmd->nsegs - first;
+}
+
+/*
+ * ex_expand - Expand every template of cmd into its slot. The
+ *    values are found and measured in one walk over the
+ *    segments and copied out in a second, into room allocated
+ *    once for the whole line.
+ */
+void ex_expand(struct cmdline_t *cmd)
+{
+    static struct arena_t arena;        /* reused for every line */
+    char status[16], pid[16];
+    struct tmpl_t *t;
+    struct seg_t *seg;
+    size_t size = 0;
+    char *out;
+
+    if (cmd->ntmpls == 0) {
+        return;
+    }
+    snprintf(status, sizeof(status), "%d", laststatus);
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+
+    for (t = cmd->tmpl; t < cmd->tmpl + cmd->ntmpls; t++) {
+        for (seg = t->seg; seg < t->seg + t->nsegs; seg++) {
+            switch (seg->kind) {
+                case SEG_TEXT:
+                    seg->val = seg->s;
+                    break;
+                case SEG_VAR:
+                    if ((seg->val = env_get(seg->s, seg->len)) == NULL) {
+                        seg->val = "";      /* unset */
+                    }
+                    break;
+                case SEG_STATUS:
+                    seg->val = status;
+                    break;
+                case SEG_PID:
+                    seg->val = pid;
+                    break;
+            }
+            seg->vlen = seg->kind == SEG_TEXT ? seg->len : strlen(seg->val);
+            size += seg->vlen;
+        }
+        size++;
+    }
+
+    arena_reset(&arena, size);
+    out = arena_alloc(&arena, size);
+    for (t = cmd->tmpl; t < cmd->tmpl + cmd->ntmpls; t++) {
+        *t->slot = out;
+        for (seg = t->seg; seg < t->seg + t->nsegs; seg++) {
+            memcpy(out, seg->val, seg->vlen);
+            out += seg->vlen;
+        }
+        *out++ = '\0';
+    }
+}
@@ -0,0 +1,628 @@
+#include "header.h"
+
+extern int laststatus;
+extern volatile sig_atomic_t atomic_intr;
+
+/*
+ * Compound commands
+ *
+ * if/then/elif/else/fi, while and until loops, `for NAME in
+ *    words` loops and && and || lists are compiled into a tree
+ *    of nodes as their lines are read, and the tree is run once
+ *    the outermost command is complete. Each simple command in
+ *    it is parsed once, into an arena of its own, so a loop that
+ *    goes round 100k times only expands and launches its
+ *    commands; the builtin and PATH lookups are kept with each
+ *    command, as they are with cached lines.
+ *
+ * A keyword is only recognized as the first word of a line, and
+ *    each has a line of its own: a condition may follow if, elif,
+ *    while and until, and the words to loop over follow for; a
+ *    list may follow then, else and do; fi and done stand alone.
+ *    && and || bind equally, left to right, and break and
+ *    continue leave or restart the innermost loop. The shell has
+ *    no `;` to run commands one after another on a line, so each
+ *    command in a body, like each keyword, takes a line of its
+ *    own.
+ *
+ * ctrl-c, whether it kills a foreground job or comes between
+ *    builtins, stops the whole command.
+ */
+
+#define MAXNEST   64                /* compound commands inside others */
+
+/* Node kinds */
+#define N_CMD      0                /* a simple command or pipeline    */
+#define N_AND      1                /* cond && body                    */
+#define N_OR       2                /* cond || body                    */
+#define N_IF       3
+#define N_WHILE    4
+#define N_UNTIL    5
+#define N_FOR      6
+#define N_BREAK    7
+#define N_CONTINUE 8
+
+/* What a compound command being read is reading */
+#define S_COND     0                /* its condition, or for's do      */
+#define S_THEN     1
+#define S_ELSE     2
+#define S_BODY     3
+
+struct node_t {                     /* A compiled command             */
+  int kind;
+  struct node_t *next;              /* the next one in its list       */
+  struct node_t *cond;              /* condition, or left of && / ||  */
+  struct node_t *body;              /* then part or loop body, or     */
+                                    /*   right of && / ||             */
+  struct node_t *els;               /* else part; an elif is an if    */
+  struct cmdline_t cmd;             /* a command, or for's words      */
+  struct arena_t arena;             /* where cmd was parsed           */
+};
+
+struct frame_t {                    /* A compound command being read  */
+  struct node_t *node;
+  struct node_t *cur;               /* the if or elif being read      */
+  int state;
+  struct node_t **tail;             /* where the next command goes    */
+};
+
+static struct frame_t frames[MAXNEST];
+static int depth;                   /* frames in use                  */
+static int loops;                   /* loops being run                */
+static int jump;                    /* N_BREAK or N_CONTINUE, on its  */
+                                    /*   way out to the loop          */
+
+static const char *reserved[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done",
+};
+
+/* newnode - A node of the given kind, with nothing in it */
+static struct node_t *newnode(int kind)
+{
+    struct node_t *n;
+
+    if ((n = calloc(1, sizeof(*n))) == NULL) {
+        unix_error("newnode error");
+    }
+    n->kind = kind;
+    return n;
+}
+
+/* freenodes - Free the list starting at n and everything in it */
+static void freenodes(struct node_t *n)
+{
+    struct node_t *next;
+
+    for (; n; n = next) {
+        next = n->next;
+        freenodes(n->cond);
+        freenodes(n->body);
+        freenodes(n->els);
+        free(n->arena.base);
+        free(n);
+    }
+}
+
+/* discard - Drop the compound commands being read */
+static void discard(void)
+{
+    while (depth > 0) {
+        freenodes(frames[--depth].node);
+    }
+}
+
+/* iskw - Is the n-byte word at w the keyword kw? */
+static int iskw(const char *w, size_t n, const char *kw)
+{
+    return n == strlen(kw) && !memcmp(w, kw, n);
+}
+
+/* isreserved - Is the n-byte word at w one that starts or ends a part? */
+static int isreserved(const char *w, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(reserved) / sizeof(*reserved); i++) {
+        if (iskw(w, n, reserved[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* skipblanks - The first character from p on that is not a blank */
+static const char *skipblanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/* wordlen - Length of the word at p, which ends at a blank */
+static size_t wordlen(const char *p, const char *end)
+{
+    const char *q = p;
+
+    while (q < end && *q != ' ' && *q != '\t') {
+        q++;
+    }
+    return q - p;
+}
+
+/* findop - The first && or || outside quotes from p on, or end */
+static const char *findop(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (*p == '\'') {
+            if ((p = memchr(p + 1, '\'', end - p - 1)) == NULL) {
+                return end;
+            }
+        }
+        else if ((*p == '&' || *p == '|') && p + 1 < end && p[1] == *p) {
+            return p;
+        }
+    }
+    return end;
+}
+
+/* unexpected - Report the n-byte word at w out of place; returns -1 */
+static int unexpected(const char *w, size_t n)
+{
+    printf("syntax error near '%.*s'\n", (int)n, w);
+    return -1;
+}
+
+/*
+ * compilecmd - Compile the len bytes at s, a command between
+ *    && and || operators, op being the one next to it. Returns
+ *    NULL after printing an error.
+ */
+static struct node_t *compilecmd(const char *s, size_t len, const char *op)
+{
+    const char *end = s + len, *w, *rest;
+    struct node_t *n;
+    size_t wlen;
+
+    w = skipblanks(s, end);
+    wlen = wordlen(w, end);
+    rest = skipblanks(w + wlen, end);
+    if (wlen == 0) {
+        unexpected(op, 2);
+        return NULL;
+    }
+    if (isreserved(w, wlen)) {
+        unexpected(w, wlen);
+        return NULL;
+    }
+
+    if (iskw(w, wlen, "break") || iskw(w, wlen, "continue")) {
+        if (rest < end) {
+            unexpected(rest, wordlen(rest, end));
+            return NULL;
+        }
+        return newnode(*w == 'b' ? N_BREAK : N_CONTINUE);
+    }
+
+    n = newnode(N_CMD);
+    if (parsein(s, len, &n->cmd, &n->arena, 1) < 0) {
+        freenodes(n);
+        return NULL;
+    }
+    return n;
+}
+
+static void run(struct node_t *n);
+
+/*
+ * append - Add n to the compound command being read, or run it
+ *    now if there is none
+ */
+static void append(struct node_t *n)
+{
+    struct frame_t *f;
+
+    if (depth == 0) {
+        run(n);
+        return;
+    }
+    f = &frames[depth - 1];
+    *f->tail = n;
+    f->tail = &n->next;
+}
+
+/*
+ * addlist - Compile the commands from p to end, joined by && and
+ *    ||, and append them. Returns -1 after printing an error.
+ */
+static int addlist(const char *p, const char *end)
+{
+    struct node_t *list = NULL, *n, *op;
+    const char *q, *prev = NULL;
+
+    if (skipblanks(p, end) == end) {
+        return 0;
+    }
+    while (TRUE) {
+        q = findop(p, end);
+        if ((n = compilecmd(p, q - p, prev ? prev : q)) == NULL) {
+            freenodes(list);
+            return -1;
+        }
+        if (list == NULL) {
+            list = n;
+        }
+        else {
+            op = newnode(*prev == '&' ? N_AND : N_OR);
+            op->cond = list;
+            op->body = n;
+            list = op;
+        }
+        if (q == end) {
+            break;
+        }
+        prev = q;
+        p = q + 2;
+    }
+    append(list);
+    return 0;
+}
+
+/* push - Start reading compound command n; returns -1 if too deep */
+static int push(struct node_t *n, struct node_t **tail)
+{
+    struct frame_t *f;
+
+    if (depth == MAXNEST) {
+        printf("syntax error: nested too deeply\n");
+        freenodes(n);
+        return -1;
+    }
+    f = &frames[depth++];
+    f->node = f->cur = n;
+    f->state = S_COND;
+    f->tail = tail;
+    return 0;
+}
+
+/* pop - Finish the compound command being read and append it */
+static void pop(void)
+{
+    append(frames[--depth].node);
+}
+
+/*
+ * compilefor - Compile the len-byte line at line, `for NAME in
+ *    words`, into n: the line is parsed as a command, whose
+ *    words from the fourth on are expanded each time the loop
+ *    starts. Returns -1 after printing an error.
+ */
+static int compilefor(struct node_t *n, const char *line, size_t len)
+{
+    const char *bad = NULL;
+    char **argv;
+
+    if (parsein(line, len, &n->cmd, &n->arena, 1) < 0) {
+        return -1;
+    }
+    argv = n->cmd.argv;
+    if (argv[1] == NULL || argv[2] == NULL) {
+        bad = "newline";
+    }
+    else if (env_namelen(argv[1]) != strlen(argv[1])) {
+        bad = argv[1];
+    }
+    else if (strcmp(argv[2], "in")) {
+        bad = argv[2];
+    }
+    else if (n->cmd.nstages > 1 || n->cmd.nredirs > 0 || n->cmd.bg) {
+        bad = "for";
+    }
+    return bad ? unexpected(bad, strlen(bad)) : 0;
+}
+
+/*
+ * compile - Compile one line, len bytes at line, into the
+ *    compound commands being read. Returns -1 after printing an
+ *    error.
+ */
+static int compile(const char *line, size_t len)
+{
+    const char *end = line + len, *w, *rest;
+    struct frame_t *f = depth ? &frames[depth - 1] : NULL;
+    struct node_t *n;
+    size_t wlen;
+    int kind;
+
+    w = skipblanks(line, end);
+    wlen = wordlen(w, end);
+    rest = skipblanks(w + wlen, end);
+    if (wlen == 0) {
+        return 0;
+    }
+
+    if (iskw(w, wlen, "if") || iskw(w, wlen, "while") || iskw(w, wlen, "until")) {
+        kind = *w == 'i' ? N_IF : *w == 'w' ? N_WHILE : N_UNTIL;
+        n = newnode(kind);
+        if (push(n, &n->cond) < 0) {
+            return -1;
+        }
+        return addlist(rest, end);
+    }
+    if (iskw(w, wlen, "for")) {
+        n = newnode(N_FOR);
+        if (compilefor(n, line, len) < 0) {
+            freenodes(n);
+            return -1;
+        }
+        return push(n, NULL);
+    }
+
+    if (iskw(w, wlen, "then")) {
+        if (f == NULL || f->node->kind != N_IF || f->state != S_COND ||
+            f->cur->cond == NULL) {
+            return unexpected(w, wlen);
+        }
+        f->state = S_THEN;
+        f->tail = &f->cur->body;
+        return addlist(rest, end);
+    }
+    if (iskw(w, wlen, "elif") || iskw(w, wlen, "else")) {
+        if (f == NULL || f->node->kind != N_IF || f->state != S_THEN) {
+            return unexpected(w, wlen);
+        }
+        if (iskw(w, wlen, "else")) {
+            f->state = S_ELSE;
+            f->tail = &f->cur->els;
+        }
+        else {
+            n = newnode(N_IF);          /* an if in the else part */
+            f->cur->els = n;
+            f->cur = n;
+            f->state = S_COND;
+            f->tail = &n->cond;
+        }
+        return addlist(rest, end);
+    }
+    if (iskw(w, wlen, "fi")) {
+        if (f == NULL || f->node->kind != N_IF || f->state == S_COND) {
+            return unexpected(w, wlen);
+        }
+        if (rest < end) {
+            return unexpected(rest, wordlen(rest, end));
+        }
+        pop();
+        return 0;
+    }
+
+    if (iskw(w, wlen, "do")) {
+        if (f == NULL || f->state != S_COND || f->node->kind == N_IF ||
+            (f->node->kind != N_FOR && f->node->cond == NULL)) {
+            return unexpected(w, wlen);
+        }
+        f->state = S_BODY;
+        f->tail = &f->node->body;
+        return addlist(rest, end);
+    }
+    if (iskw(w, wlen, "done")) {
+        if (f == NULL || f->state != S_BODY) {
+            return unexpected(w, wlen);
+        }
+        if (rest < end) {
+            return unexpected(rest, wordlen(rest, end));
+        }
+        pop();
+        return 0;
+    }
+
+    if (f && f->tail == NULL) {
+        return unexpected(w, wlen);     /* for's words, then no do */
+    }
+    return addlist(line, end);
+}
+
+static void runlist(struct node_t *n);
+
+/*
+ * runloop - Run a while or until loop n. Its status is that of
+ *    the body the last time it ran, 0 if it never did.
+ */
+static void runloop(struct node_t *n)
+{
+    int status = 0;
+
+    for (loops++; !atomic_intr; jump = 0) {
+        runlist(n->cond);
+        if (!jump && (laststatus == 0) == (n->kind == N_WHILE)) {
+            runlist(n->body);
+            status = laststatus;
+        }
+        else if (!jump) {
+            break;
+        }
+        if (jump == N_BREAK) {
+            jump = 0;
+            break;
+        }
+    }
+    loops--;
+    if (!atomic_intr) {
+        laststatus = status;
+    }
+}
+
+/*
+ * runfor - Run a for loop n. The words are expanded once, and
+ *    copied as NAME=word strings, since running the body reuses
+ *    the buffers they were expanded into.
+ */
+static void runfor(struct node_t *n)
+{
+    struct cmdline_t cmd;
+    char **argv, **words, *p;
+    size_t namelen, size = 0;
+    int i, nwords, status = 0;
+
+    lc_use(&cmd, &n->cmd);
+    ex_expand(&cmd);
+    gl_expand(&cmd);
+    argv = cmd.argv + 3;
+    namelen = strlen(cmd.argv[1]);
+    for (nwords = 0; argv[nwords]; nwords++) {
+        size += namelen + strlen(argv[nwords]) + 2;
+    }
+    if (nwords == 0) {
+        laststatus = 0;
+        return;
+    }
+
+    if ((words = malloc(nwords * sizeof(char *) + size)) == NULL) {
+        unix_error("runfor error");
+    }
+    p = (char *)(words + nwords);
+    for (i = 0; i < nwords; i++) {
+        words[i] = p;
+        p += sprintf(p, "%s=%s", cmd.argv[1], argv[i]) + 1;
+    }
+
+    for (loops++, i = 0; i < nwords && !atomic_intr; i++, jump = 0) {
+        env_assign(words[i], 0);
+        runlist(n->body);
+        status = laststatus;
+        if (jump == N_BREAK) {
+            jump = 0;
+            break;
+        }
+    }
+    loops--;
+    free(words);
+    if (!atomic_intr) {
+        laststatus = status;
+    }
+}
+
+/* runnode - Run the compiled command n */
+static void runnode(struct node_t *n)
+{
+    struct cmdline_t cmd;
+
+    switch (n->kind) {
+        case N_CMD:
+            lc_use(&cmd, &n->cmd);
+            evalcmd(&cmd);
+            break;
+        case N_AND:
+        case N_OR:
+            runnode(n->cond);
+            if (!jump && !atomic_intr &&
+                (laststatus == 0) == (n->kind == N_AND)) {
+                runnode(n->body);
+            }
+            break;
+        case N_IF:
+            runlist(n->cond);
+            if (jump || atomic_intr) {
+                break;
+            }
+            if (laststatus == 0) {
+                runlist(n->body);
+            }
+            else if (n->els) {
+                runlist(n->els);
+            }
+            else {
+                laststatus = 0;
+            }
+            break;
+        case N_WHILE:
+        case N_UNTIL:
+            runloop(n);
+            break;
+        case N_FOR:
+            runfor(n);
+            break;
+        case N_BREAK:
+        case N_CONTINUE:
+            if (loops > 0) {
+                jump = n->kind;
+            }
+            else {
+                printf("%s: only meaningful in a loop\n",
+                    n->kind == N_BREAK ? "break" : "continue");
+            }
+            laststatus = 0;
+            break;
+    }
+}
+
+/* runlist - Run the list starting at n, until a break or continue */
+static void runlist(struct node_t *n)
+{
+    for (; n && !jump && !atomic_intr; n = n->next) {
+        runnode(n);
+    }
+}
+
+/* run - Run n, a complete command read at the top level, and free it */
+static void run(struct node_t *n)
+{
+    atomic_intr = 0;
+    runlist(n);
+    jump = 0;
+    freenodes(n);
+}
+
+/*
+ * fl_eval - Evaluate a line of input, len bytes at line, once
+ *    history expanded. A line outside a compound command that
+ *    neither starts one nor holds && or || goes straight to
+ *    eval; any other is compiled.
+ */
+void fl_eval(const char *line, size_t len)
+{
+    const char *end, *w;
+    size_t wlen;
+
+    if (hist_expand(&line, &len) < 0) {
+        discard();
+        laststatus = 1;
+        return;
+    }
+    hist_add(line, len);
+
+    if (depth == 0) {
+        end = line + len;
+        w = skipblanks(line, end);
+        wlen = wordlen(w, end);
+        if (!isreserved(w, wlen) && !iskw(w, wlen, "break") &&
+            !iskw(w, wlen, "continue") && findop(w, end) == end) {
+            eval(line, len);
+            return;
+        }
+    }
+
+    if (compile(line, len) < 0) {
+        discard();
+        laststatus = 2;
+    }
+}
+
+/* fl_prompt - The prompt to show: prompt, or > inside a compound command */
+const char *fl_prompt(const char *prompt)
+{
+    return depth ? "> " : prompt;
+}
+
+/*
+ * fl_end - The shell's exit status at the end of its input, which
+ *    must not be inside a compound command
+ */
+int fl_end(void)
+{
+    if (depth > 0) {
+        printf("syntax error: unexpected end of file\n");
+        discard();
+        return 2;
+    }
+    return laststatus;
+}
@@ -0,0 +1,397 @@
+#include "header.h"
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*
+ * Pathname expansion (globbing)
+ *
+ * A word outside quotes holding *, ? or a [...] class is
+ *    replaced by the paths it matches, in sorted order, or left
+ *    as it is if it matches nothing. Names starting with a dot
+ *    are only matched by a pattern that starts with one, and
+ *    . and .. never are.
+ *
+ * Each directory a pattern looks in is read with getdents64
+ *    into one block of names, which is sorted once and kept in
+ *    a small cache keyed on the directory's path, device, inode
+ *    and mtime. Globbing the same directory again costs one
+ *    stat while it is unchanged. A listing read within a second
+ *    of the directory changing may have missed a change made in
+ *    the same mtime tick, so it is used once but read again the
+ *    next time.
+ *
+ * A pattern with more than one level walks a listing while it
+ *    looks in the directories below; that listing is marked busy,
+ *    and one that would replace it in the cache is read for the
+ *    moment instead.
+ *
+ * The matches for a line are copied into one buffer and argv
+ *    is rebuilt around them; no match gets an allocation of its
+ *    own.
+ */
+
+#define DIRSLOTS  64                /* cached listings (power of 2) */
+#define DENTBUF   65536             /* getdents64 buffer            */
+
+struct dirent64_t {                 /* As getdents64 returns them   */
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+struct listing_t {                  /* A cached directory listing   */
+  char *path;                       /* as the pattern names it      */
+  dev_t dev;                        /* which directory it is        */
+  ino_t ino;
+  struct timespec mtime;            /* when it was last changed     */
+  int racy;                         /* read in its mtime's second   */
+  char *names;                      /* every name, NUL terminated   */
+  char **sorted;                    /* into names, in strcmp order  */
+  int n;
+  int busy;                         /* being walked, so kept        */
+};
+
+static struct listing_t cache[DIRSLOTS];
+
+static char *text;                  /* matches of the current line  */
+static size_t textlen, textcap;
+static size_t *offs;                /* where each match starts      */
+static size_t noffs, offcap;
+static char **newargv;              /* the rebuilt argv             */
+static size_t argvcap;
+
+/* dirhash - FNV-1a hash of a directory path */
+static unsigned dirhash(const char *path)
+{
+    unsigned h = 2166136261u;
+
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* byname - qsort comparison of two name pointers */
+static int byname(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* grow - Make room for n more elements of size bytes in *p */
+static void grow(void *p, size_t *cap, size_t used, size_t n, size_t size)
+{
+    void *q;
+
+    if (used + n <= *cap) {
+        return;
+    }
+    *cap = (used + n) * 2;
+    if ((q = realloc(*(void **)p, *cap * size)) == NULL) {
+        unix_error("glob error");
+    }
+    *(void **)p = q;
+}
+
+/* dropdir - Empty a cache slot */
+static void dropdir(struct listing_t *l)
+{
+    free(l->path);
+    free(l->names);
+    free(l->sorted);
+    memset(l, 0, sizeof(*l));
+}
+
+/*
+ * readlisting - Read the directory open on fd into l: every name
+ *    but . and .., each after its d_type byte, in one block, and
+ *    an array of them in sorted order. Returns -1 if it cannot
+ *    be read.
+ */
+static int readlisting(int fd, struct listing_t *l)
+{
+    static char *buf;
+    struct dirent64_t *d;
+    size_t used = 0, cap = 0, len;
+    long got, pos;
+    char *p;
+    int i, n = 0;
+
+    if (buf == NULL && (buf = malloc(DENTBUF)) == NULL) {
+        unix_error("glob error");
+    }
+    while ((got = syscall(SYS_getdents64, fd, buf, DENTBUF)) > 0) {
+        for (pos = 0; pos < got; pos += d->d_reclen) {
+            d = (struct dirent64_t *)(buf + pos);
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+            len = strlen(d->d_name) + 1;
+            grow(&l->names, &cap, used, len + 1, 1);
+            l->names[used] = d->d_type;
+            memcpy(l->names + used + 1, d->d_name, len);
+            used += len + 1;
+            n++;
+        }
+    }
+    if (got < 0) {
+        return -1;
+    }
+
+    if ((l->sorted = malloc((n + 1) * sizeof(char *))) == NULL) {
+        unix_error("glob error");
+    }
+    for (i = 0, p = l->names; i < n; i++, p += strlen(p) + 1) {
+        l->sorted[i] = ++p;
+    }
+    qsort(l->sorted, n, sizeof(char *), byname);
+    l->n = n;
+    return 0;
+}
+
+/*
+ * listdir - The listing of directory path ("" for the current
+ *    one), from the cache while the directory is unchanged, or
+ *    NULL if it cannot be read. If its cache slot is busy with
+ *    another listing it is read into tmp, which the caller
+ *    empties with dropdir.
+ */
+static struct listing_t *listdir(const char *path, struct listing_t *tmp)
+{
+    struct listing_t *l = &cache[dirhash(path) & (DIRSLOTS - 1)];
+    const char *dir = *path ? path : ".";
+    struct timespec now;
+    struct stat st;
+    int fd;
+
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    if (l->path && !l->racy && !strcmp(l->path, path) &&
+        l->dev == st.st_dev && l->ino == st.st_ino &&
+        l->mtime.tv_sec == st.st_mtim.tv_sec &&
+        l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return l;
+    }
+
+    if (l->busy) {
+        l = tmp;
+    }
+    dropdir(l);
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || readlisting(fd, l) < 0) {
+        close(fd);
+        dropdir(l);
+        return NULL;
+    }
+    close(fd);
+
+    if ((l->path = strdup(path)) == NULL) {
+        unix_error("glob error");
+    }
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    clock_gettime(CLOCK_REALTIME, &now);
+    l->racy = st.st_mtim.tv_sec >= now.tv_sec - 1;
+    return l;
+}
+
+/* hasglob - Does s hold a *, a ? or a [...] class? */
+int hasglob(const char *s)
+{
+    const char *p;
+
+    for (p = s; (p = strpbrk(p, "*?[")) != NULL; p++) {
+        if (*p != '[' || strchr(p + 1, ']')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* addmatch - Add the len-byte path at path to the line's matches */
+static void addmatch(const char *path, size_t len)
+{
+    grow(&text, &textcap, textlen, len + 1, 1);
+    grow(&offs, &offcap, noffs, 1, sizeof(*offs));
+    offs[noffs++] = textlen;
+    memcpy(text + textlen, path, len);
+    text[textlen + len] = '\0';
+    textlen += len + 1;
+}
+
+/* isdir - Is name, a listed entry whose path is path, a directory? */
+static int isdir(const char *path, const char *name)
+{
+    struct stat st;
+
+    if (name[-1] == DT_DIR) {
+        return 1;
+    }
+    if (name[-1] != DT_UNKNOWN && name[-1] != DT_LNK) {
+        return 0;
+    }
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * firstwith - Index of the first of l's sorted names that is not
+ *    below the len-byte prefix at s
+ */
+static int firstwith(const struct listing_t *l, const char *s, size_t len)
+{
+    int lo = 0, hi = l->n, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strncmp(l->sorted[mid], s, len) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * globpath - Add the matches of pattern pat below the directory
+ *    whose path is the len bytes in path, ending in / unless it
+ *    is empty. path has room for MAXLINE bytes.
+ */
+static void globpath(char *path, size_t len, const char *pat)
+{
+    struct listing_t *l, tmp;
+    const char *slash, *name;
+    char comp[MAXLINE];
+    struct stat st;
+    size_t clen, nlen, plen;
+    int i;
+
+    if (*pat == '\0') {
+        addmatch(path, len);
+        return;
+    }
+    slash = strchr(pat, '/');
+    clen = slash ? (size_t)(slash - pat) : strlen(pat);
+    if (len + clen + 2 > MAXLINE) {
+        return;
+    }
+    memcpy(comp, pat, clen);
+    comp[clen] = '\0';
+    while (slash && *slash == '/') {
+        slash++;
+    }
+
+    /* A component with no pattern in it only has to exist */
+    if (!hasglob(comp)) {
+        memcpy(path + len, comp, clen + 1);
+        if (slash) {
+            strcpy(path + len + clen, "/");
+            globpath(path, len + clen + 1, slash);
+        }
+        else if (lstat(path, &st) == 0) {
+            addmatch(path, len + clen);
+        }
+        path[len] = '\0';
+        return;
+    }
+
+    memset(&tmp, 0, sizeof(tmp));
+    if ((l = listdir(path, &tmp)) == NULL) {
+        return;
+    }
+    /* Only the names starting with the pattern's literal prefix
+     * can match, and they are together in the sorted listing
+     */
+    plen = strchr(comp, '\\') ? 0 : strcspn(comp, "*?[");
+    l->busy++;
+    for (i = firstwith(l, comp, plen); i < l->n; i++) {
+        name = l->sorted[i];
+        if (strncmp(name, comp, plen)) {
+            break;
+        }
+        nlen = strlen(name);
+        if ((*name == '.' && *comp != '.') || len + nlen + 2 > MAXLINE ||
+            fnmatch(comp, name, FNM_PERIOD)) {
+            continue;
+        }
+        memcpy(path + len, name, nlen + 1);
+        if (slash == NULL) {
+            addmatch(path, len + nlen);
+        }
+        else if (isdir(path, name)) {
+            strcpy(path + len + nlen, "/");
+            globpath(path, len + nlen + 1, slash);
+        }
+    }
+    l->busy--;
+    path[len] = '\0';
+    if (l == &tmp) {
+        dropdir(&tmp);
+    }
+}
+
+/*
+ * gl_expand - Replace each of cmd's words marked in parseline as
+ *    a pattern by the paths it matches. argv is rebuilt in a
+ *    buffer reused by the next line, with the stages moved to
+ *    make room.
+ */
+void gl_expand(struct cmdline_t *cmd)
+{
+    char path[MAXLINE], **argv = cmd->argv, *word;
+    int i, g, s, nargv, *first, shift;
+
+    if (cmd->nglobs == 0) {
+        return;
+    }
+
+    /* Match every pattern, noting where its matches start */
+    textlen = 0;
+    noffs = 0;
+    first = cmd->globs + cmd->nglobs;       /* room set aside by reserve */
+    for (g = 0; g < cmd->nglobs; g++) {
+        first[g] = noffs;
+        word = argv[cmd->globs[g]];
+        if (hasglob(word)) {
+            strcpy(path, *word == '/' ? "/" : "");
+            globpath(path, strlen(path), word + strspn(word, "/"));
+        }
+    }
+    first[g] = noffs;
+    if (noffs == 0) {
+        return;
+    }
+
+    /* Every stage's words are followed by a NULL */
+    for (nargv = cmd->stage[cmd->nstages-1].argv; argv[nargv]; nargv++)
+        ;
+    nargv++;
+    grow(&newargv, &argvcap, 0, nargv + noffs, sizeof(*newargv));
+
+    for (i = 0, g = 0, s = 1, shift = 0; i < nargv; i++) {
+        if (s < cmd->nstages && cmd->stage[s].argv == i) {
+            cmd->stage[s++].argv += shift;
+        }
+        if (g < cmd->nglobs && cmd->globs[g] == i && first[g+1] > first[g]) {
+            for (; first[g] < first[g+1]; first[g]++, shift++) {
+                newargv[i + shift] = text + offs[first[g]];
+            }
+            shift--;
+            g++;
+            continue;
+        }
+        g += g < cmd->nglobs && cmd->globs[g] == i;
+        newargv[i + shift] = argv[i];
+    }
+    cmd->argv = newargv;
+}
@@ -1,6 +1,9 @@
 #include "header.h"
 
 extern sig_atomic_t atomic_fggpid;
+extern int laststatus;
+
+volatile sig_atomic_t atomic_intr = 0;  /* ctrl-c, with no foreground job */
 
 /*
  * sigchld_handler - The kernel sends a SIGCHLD to the shell
@@ -14,16 +17,23 @@ void sigchld_handler(int sig)
 {
     int status, olderrno = errno;
     sigset_t mask_all, prev_all;
+    struct rusage ru;
     pid_t pid;
-    struct job_t *job;
 
-    Log("REAP [0]\n", 9);
+    Trace(TR_REAP, 0, 0, 0);
 
     Sigfillset(&mask_all);
 
     while (TRUE) {
 
-        pid = waitpid(-1, &status, WNOHANG | WUNTRACED);
+        /* batchwait may start a parallel job's next instance,
+         * so reaping happens with every signal blocked
+         */
+        Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+        if ((pid = batchwait(&status, &ru)) > 0) {
+            reapchild(pid, status, &ru);
+        }
+        Sigprocmask(SIG_SETMASK, &prev_all, NULL);
 
         /* `waitpid` returns 0 when no children are left
          * to be reaped, this accounts for stopped processes
@@ -41,59 +51,119 @@ void sigchld_handler(int sig)
         else if (pid < 0) {
             break;
         }
+    }
 
-        Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+    if (errno != ECHILD) {
+        Sio_error("waitpid error\n", 14);
+    }
 
-        job = getjobpid(jobs, pid);
+    Trace(TR_REAP, 2, 0, 0);
 
-        /* If process terminated because of a signal
-         *      that was not caught, print out a
-         *      status message
-         */
-        if (WIFSIGNALED(status)) {
-            printf("Job [%d] (%d) terminated by signal %d\n",
-                job->jid, pid, WTERMSIG(status));
-        }
+    errno = olderrno;
+}
 
-        /*
-         * If process was stopped we print out
-         *      a message notifying this and continue
-         *      before deleting the job.
-         */
-        if (WIFSTOPPED(status)) {
-            printf("Job [%d] (%d) stopped by signal %d\n",
-                job->jid, pid, WSTOPSIG(status));
-            job->state = ST;
-            atomic_fggpid = 0;
-            /* Skips remaining portion of loop,
-             * including unblocking blocked
-             * signals so do it here
-             */
-            Sigprocmask(SIG_SETMASK, &prev_all, NULL);
-            continue;
-        }
+/*
+ * reapchild - Update the job table for a child whose status
+ *    (and resource usage, ru) was just collected. Called by
+ *    sigchld_handler with all signals blocked, or from normal
+ *    context by the event loop. A job ends when its last member
+ *    is reaped, and stops as soon as any member stops.
+ */
+void reapchild(pid_t pid, int status, const struct rusage *ru)
+{
+    struct job_t *job = getjobpid(&jobs, pid);
+    int code;
 
-        /* Closes foreground processes which
-         * exit without interruption
-         * from user sent signals
-         */
-        if (pid == atomic_fggpid) {
+    Trace(TR_REAP, 1, pid, job ? job->jid : 0);
+
+    if (job == NULL) {
+        return;
+    }
+
+    /*
+     * If a member was stopped we print out
+     *      a message notifying this once for the
+     *      job and return before deleting it.
+     */
+    if (WIFSTOPPED(status)) {
+        job->stopsig = WSTOPSIG(status);
+        if (job->state != ST) {
+            notify("Job [%d] (%d) stopped by signal %d\n",
+                job->jid, job->pid, WSTOPSIG(status));
+            setjobstate(&jobs, job, ST);
+        }
+        if (job->pid == atomic_fggpid) {
+            laststatus = 128 + WSTOPSIG(status);
             atomic_fggpid = 0;
         }
-        deletejob(jobs, pid);
+        return;
+    }
 
-        Log("REAP [1]\n", 9);
+    addusage(&job->stats.usage, ru);
 
-        Sigprocmask(SIG_SETMASK, &prev_all, NULL);
+    /* A pipeline's status is its final stage's; a parallel
+     * job fails if any of its instances does
+     */
+    code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (job->batch ? code != 0 : pid == job->lastpid) {
+        job->status = code;
+    }
+    if (job->timedout && job->status != 128 + SIGKILL) {
+        job->status = 124;      /* as timeout(1) reports it */
     }
 
-    if (errno != ECHILD) {
-        Sio_error("waitpid error\n", 14);
+    /* Remember the signal that killed a member. SIGPIPE only
+     * counts for the final stage, since earlier stages
+     * routinely die of it when a later stage exits.
+     */
+    if (WIFSIGNALED(status) && !job->termsig &&
+        (WTERMSIG(status) != SIGPIPE || pid == job->lastpid || job->batch)) {
+        job->termsig = WTERMSIG(status);
     }
 
-    Log("REAP [2]\n", 9);
+    if (pid == job->pid) {
+        ev_unwatch(job);
+    }
 
-    errno = olderrno;
+    /* A parallel job replaces each instance that ends */
+    if (job->batch && batchnext(job, pid)) {
+        return;
+    }
+
+    if (job->npids > 1) {
+        dropmember(&jobs, job, pid);
+        return;
+    }
+
+    /* If the job terminated because of a signal
+     *      that was not caught, print out a
+     *      status message
+     */
+    if (job->termsig) {
+        notify("Job [%d] (%d) terminated by signal %d\n",
+            job->jid, job->pid, job->termsig);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->stats.end);
+    if (job->timed) {
+        printtime(&job->stats.start, &job->stats.end, &job->stats.usage);
+    }
+
+    /* Closes foreground processes which
+     * exit without interruption
+     * from user sent signals
+     */
+    if (job->state == FG) {
+        laststatus = job->status;
+        if (job->termsig == SIGINT) {
+            atomic_intr = 1;    /* also stops the loop it ran in */
+        }
+    }
+    if (job->pid == atomic_fggpid) {
+        atomic_fggpid = 0;
+    }
+    jobended(job);
+    deletejob(&jobs, pid);
 }
 
 /*
@@ -106,21 +176,25 @@ void sigint_handler(int sig)
     int olderrno = errno;
     sigset_t mask, prev;
 
-    Log("TERM [0]\n", 9);
+    Trace(TR_TERM, 0, 0, 0);
 
     Sigfillset(&mask);
     Sigprocmask(SIG_BLOCK, &mask, &prev);
 
-    /* There a no currently running foreground jobs to terminate */
+    /* There a no currently running foreground jobs to terminate,
+     * but a builtin such as sleep may be waiting
+     */
     if (!atomic_fggpid) {
+        atomic_intr = 1;
+        errno = olderrno;
         return;
     }
 
-    Log("TERM [1]\n", 9);
+    Trace(TR_TERM, 1, atomic_fggpid, 0);
 
     Kill(-atomic_fggpid, SIGINT);
 
-    Log("TERM [2]\n", 9);
+    Trace(TR_TERM, 2, atomic_fggpid, 0);
 
     Sigprocmask(SIG_SETMASK, &prev, NULL);
 
@@ -138,7 +212,7 @@ void sigtstp_handler(int sig)
     int olderrno = errno;
     sigset_t mask, prev;
 
-    Log("STOP [0]\n", 9);
+    Trace(TR_STOP, 0, 0, 0);
 
     Sigfillset(&mask);
     Sigprocmask(SIG_BLOCK, &mask, &prev);
@@ -148,23 +222,44 @@ void sigtstp_handler(int sig)
         return;
     }
 
-    Log("STOP [1]\n", 9);
+    Trace(TR_STOP, 1, atomic_fggpid, 0);
 
     Kill(-atomic_fggpid, SIGTSTP);
 
-    Log("STOP [2]\n", 9);
+    Trace(TR_STOP, 2, atomic_fggpid, 0);
 
     Sigprocmask(SIG_SETMASK, &prev, NULL);
 
     errno = olderrno;
 }
 
+/*
+ * sigalrm_handler - The timer behind `timeout` fires when the
+ *    earliest deadline passes. Signal the jobs that are due.
+ */
+void sigalrm_handler(int sig)
+{
+    int olderrno = errno;
+    sigset_t mask, prev;
+
+    Sigfillset(&mask);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    tm_expire();
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    errno = olderrno;
+}
+
 /*
  * sigquit_handler - The driver program can gracefully terminate
- *    the child shell by sending it a SIGQUIT signal
+ *    the child shell by sending it a SIGQUIT signal. stdio and
+ *    the atexit hooks are not safe here, so the message is
+ *    written directly and the shell leaves with _exit; whatever
+ *    stdout still holds is dropped.
  */
 void sigquit_handler(int sig)
 {
-    printf("Terminating after receipt of SIGQUIT signal\n");
-    exit(1);
+    static char msg[] = "Terminating after receipt of SIGQUIT signal\n";
+
+    sio_puts(msg, sizeof(msg) - 1);
+    _exit(1);
 }
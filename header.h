@@ -1,6 +1,8 @@
 #ifndef header_h
 #define header_h
 
+#define _GNU_SOURCE            /* pipe2, CPU sets, ...  */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,12 +12,21 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <spawn.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 /* Misc manifest constants */
-#define MAXLINE   1024        /* max line size                 */
-#define MAXARGS   128         /* max args on a command line    */
-#define MAXJOBS   16          /* max jobs at any point in time */
+#define MAXLINE   1024        /* size of message/path buffers  */
+#define ARENAMIN  4096        /* smallest command arena kept   */
+#define ARENALIGN 16          /* alignment of arena blocks     */
+#define INITJOBS  16          /* initial size of the job table */
 #define MAXID     1<<16       /* max job ID                    */
+#define NLIMITS   5           /* resource limits ulimit sets   */
 
 /* Job states */
 #define UNDEF 0     /* undefined             */
@@ -23,6 +34,11 @@
 #define BG    2     /* running in background */
 #define ST    3     /* stopped               */
 
+/* Launch modes */
+#define LAUNCH_SPAWN  0 /* posix_spawn (vfork-style, default) */
+#define LAUNCH_FORK   1 /* fork + execve                      */
+#define LAUNCH_ZYGOTE 2 /* cloned by the zygote helper        */
+
 /*
  * Jobs states: FG (foreground), BG (background), ST (stopped)
  * Job state transitions and enabling action:
@@ -33,6 +49,19 @@
  * At most 1 job can be in the FG state.
  */
 
+/* Trace events (see trace.c) */
+#define TR_EVAL   0     /* eval                      */
+#define TR_LAUNCH 1     /* a process was started     */
+#define TR_REAP   2     /* sigchld_handler           */
+#define TR_TERM   3     /* sigint_handler            */
+#define TR_STOP   4     /* sigtstp_handler           */
+#define TR_WAITFG 5     /* waitfg                    */
+#define TR_EVWAIT 6     /* ev_wait                   */
+
+/* Record a trace event, at no cost while tracing is off */
+#define Trace(ev, step, pid, jid) \
+    do { if (tracing) trace_event(ev, step, pid, jid); } while (0)
+
 /* Helpers */
 #define TRUE  1
 #define CHILD 0
@@ -40,46 +69,349 @@
 typedef void handler_t(int);
 typedef int jid_t;
 
-struct job_t {                    /* The job struct       */
-  pid_t pid;                      /* job PID              */
-  jid_t jid;                      /* job ID [1, 2, .. ]   */
-  int state;                      /* UNDEF, BG, FG, or ST */
-  char cmdline[MAXLINE];          /* command line         */
+struct batch_t;
+
+struct jobstats_t {               /* A job's resource usage   */
+  time_t started;                 /* wall-clock launch time   */
+  struct timespec start;          /* launch (CLOCK_MONOTONIC) */
+  struct timespec end;            /* last member reaped       */
+  struct rusage usage;            /* of the reaped members    */
+};
+
+struct job_t {                    /* The job struct           */
+  pid_t pid;                      /* job PID (process group)  */
+  jid_t jid;                      /* job ID [1, 2, .. ]       */
+  int state;                      /* UNDEF, BG, FG, or ST     */
+  char *cmdline;                  /* command line             */
+  size_t cmdsize;                 /* bytes held by cmdline    */
+  pid_t *pids;                    /* live member PIDs         */
+  int npids;                      /* entries in pids          */
+  int pidcap;                     /* room in pids             */
+  pid_t lastpid;                  /* PID of the final stage   */
+  int termsig;                    /* signal that killed it    */
+  int stopsig;                    /* signal that stopped it   */
+  int status;                     /* exit status, as in $?    */
+  int pidfd;                      /* leader pidfd (-e), or -1 */
+  struct batch_t *batch;          /* parallel's instances     */
+  int timed;                      /* report usage when done   */
+  struct jobstats_t stats;        /* resource usage           */
+  unsigned timerid;               /* its timeout, 0 if none   */
+  int timedout;                   /* its timeout has passed   */
+  int pinned;                     /* has a CPU mask of its own */
+  cpu_set_t cpus;                 /* the mask, if pinned      */
+};
+
+struct pident_t {                 /* A PID index entry        */
+  pid_t pid;                      /* member PID               */
+  jid_t jid;                      /* its job, 0 if empty      */
+};
+
+struct joblist_t {                /* The job table            */
+  struct job_t *slots;            /* JID j is in slots[j-1]   */
+  int size;                       /* number of slots          */
+  jid_t *freejids;                /* min-heap of unused JIDs  */
+  int nfree;                      /* entries in freejids      */
+  struct pident_t *pidindex;      /* member PID -> JID        */
+  int pidslots;                   /* size of pidindex         */
+  int npidents;                   /* entries in pidindex      */
+  int reserved;                   /* entries kept for batches */
+  int nbatches;                   /* jobs that are batches    */
+  int fg;                         /* slot of FG job, or -1    */
+};
+
+extern struct joblist_t jobs;
+
+struct redir_t {                  /* A redirection [n]op target     */
+  int fd;                         /* descriptor being redirected    */
+  int from;                       /* n>&m's m, or path once opened  */
+  char *path;                     /* file to open, NULL for n>&m    */
+  int flags;                      /* open flags for path            */
+  int saved;                      /* builtins: the shell's own fd   */
 };
 
-struct job_t jobs[MAXJOBS];
+struct limit_t {                  /* A resource limit to set        */
+  int resource;                   /* RLIMIT_...                     */
+  struct rlimit rl;               /* its soft and hard values       */
+};
+
+struct seg_t {                    /* A piece of a word template     */
+  int kind;                       /* SEG_TEXT, SEG_VAR, ...         */
+  const char *s;                  /* the text, or variable name     */
+  size_t len;                     /* bytes at s                     */
+  const char *val;                /* while expanding: its value     */
+  size_t vlen;                    /*   and the value's length       */
+};
+
+struct tmpl_t {                   /* A word that needs expanding    */
+  char **slot;                    /* argv entry or redirection path */
+  struct seg_t *seg;              /* its pieces, in order           */
+  int nsegs;                      /* number of pieces               */
+};
+
+struct stage_t {                  /* A pipeline stage               */
+  int argv;                       /* argv index where it starts     */
+  int redir;                      /* its first entry in redir       */
+  int nredirs;                    /* number of its redirections     */
+  pid_t pid;                      /* its process, once launched     */
+  char **assigns;                 /* its leading NAME=value words   */
+  int nassigns;                   /* number of them                 */
+};
+
+struct lookup_t {                 /* A stage's command, looked up   */
+  const char *biname;             /* word checked for a builtin     */
+  const void *bi;                 /* the builtin, or NULL           */
+  const char *name;               /* word searched for on PATH      */
+  const char *path;               /* where it was found             */
+  int slot;                       /* its path cache slot, or -1     */
+  unsigned gen;                   /* path cache generation then     */
+};
+
+struct cmdline_t {                /* A parsed command line          */
+  const char *text;               /* the line it was parsed from    */
+  size_t len;                     /* bytes in text                  */
+  int bg;                         /* ends in '&'                    */
+  int timed;                      /* prefixed with time             */
+  int pinned;                     /* placed on the CPUs in cpus     */
+  cpu_set_t cpus;                 /* (cpu LIST, or cpu spread)      */
+  struct limit_t limits[NLIMITS]; /* set in its processes (ulimit)  */
+  int nlimits;                    /* entries in limits              */
+  double timeout;                 /* seconds it may run, 0: forever */
+  int timeoutsig;                 /* signal sent when they are up   */
+  double grace;                   /* then SIGKILL after this, if >0 */
+  char **argv;                    /* stage args, NULL after each    */
+  struct stage_t *stage;          /* the pipeline stages            */
+  int nstages;                    /* number of pipeline stages      */
+  struct redir_t *redir;          /* redirections, in stage order   */
+  int nredirs;                    /* entries in redir               */
+  struct tmpl_t *tmpl;            /* words holding parameters       */
+  int ntmpls;                     /* entries in tmpl                */
+  struct seg_t *seg;              /* the templates' pieces          */
+  int nsegs;                      /* entries in seg                 */
+  int *globs;                     /* argv indexes of pattern words  */
+  int nglobs;                     /* entries in globs               */
+  struct lookup_t *lookup;        /* each stage's, kept with a line */
+  const char *words;              /* the words, as parsed           */
+  size_t wordsize;                /* bytes at words                 */
+};
+
+struct batch_t {                  /* A parallel job's instances     */
+  const char *path;               /* the command they all run       */
+  char ***argvs;                  /* argument vector of each        */
+  int ninst;                      /* number of instances            */
+  int next;                       /* next one to start              */
+  int max;                        /* most running at once (-j)      */
+  pid_t ahead;                    /* replaced, but not yet reaped   */
+  sigset_t mask;                  /* signal mask they start with    */
+  struct redir_t stdio[3];        /* the stdin/out/err they get     */
+  int pinned;                     /* run on cpus (cpu, spreading)   */
+  cpu_set_t cpus;
+  struct limit_t limits[NLIMITS]; /* set in each of them (ulimit)   */
+  int nlimits;
+};
+
+struct arena_t {                  /* Memory released all at once    */
+  char *base;                     /* the block                      */
+  size_t size;                    /* bytes in the block             */
+  size_t used;                    /* bytes handed out               */
+};
+
+struct fdmove_t {                 /* dup2(from, to) in the child    */
+  int from;
+  int to;
+};
+
+struct proc_t {                   /* One process to launch          */
+  const char *path;               /* executable to run              */
+  char **argv;                    /* its argument vector            */
+  pid_t pgid;                     /* group to join, 0 for a new one */
+  struct fdmove_t moves[2];       /* pipe ends to move into place   */
+  int nmoves;                     /* entries in moves               */
+  struct redir_t *redir;          /* then its redirections, in order */
+  int nredirs;                    /* entries in redir               */
+  const cpu_set_t *cpus;          /* CPUs to run on, NULL: inherit  */
+  const struct limit_t *limits;   /* resource limits to set         */
+  int nlimits;                    /* entries in limits              */
+  char **envp;                    /* its environment                */
+};
+
+struct reader_t {                 /* A source of command lines      */
+  int fd;                         /* descriptor read, -1 if none    */
+  char *buf;                      /* input buffer or mapped script  */
+  size_t size;                    /* bytes held by buf              */
+  size_t start;                   /* first unread byte              */
+  size_t len;                     /* unread bytes                   */
+  size_t scanned;                 /* unread bytes with no newline   */
+  int eof;                        /* nothing more to read           */
+};
 
 /* Function Prototypes */
 
 /* util.h    */
 void unix_error(char *msg);
 void app_error(char *msg);
-void Log(char *msg, int len);
-void eval(char *cmdline);
-int parseline(const char *cmdline, char *argv[]);
-int builtin_cmd(char *argv[]);
-void waitfg(pid_t pid);
+void eval(const char *cmdline, size_t len);
+void evalcmd(struct cmdline_t *cmd);
+int parseline(const char *cmdline, size_t len, struct cmdline_t *cmd);
+int parsein(const char *cmdline, size_t len, struct cmdline_t *cmd,
+            struct arena_t *arena, int keep);
+int waitfor(int (*done)(void *arg), void *arg, const struct timespec *deadline);
+void waitfg(void);
+
+/* builtin.h */
+int isbuiltin(struct cmdline_t *cmd);
+int builtin_cmd(struct cmdline_t *cmd);
 
 /* handler.h */
 void sigchld_handler(int sig);
 void sigint_handler(int sig);
 void sigtstp_handler(int sig);
 void sigquit_handler(int sig);
+void sigalrm_handler(int sig);
+void reapchild(pid_t pid, int status, const struct rusage *ru);
+
+/* event.h   */
+void lockjobs(const sigset_t *mask, sigset_t *prev);
+void unlockjobs(const sigset_t *prev);
+void ev_init(void);
+void ev_run(struct reader_t *rd, int emit_prompt);
+void ev_wait(int timeout);
+void ev_watch(struct job_t *job);
+void ev_unwatch(struct job_t *job);
 
 /* cmd.h     */
-void do_bgfg(char **argv);
-void listjobs(struct job_t *jobs);
+int do_bgfg(char **argv);
+int do_hash(char **argv);
+void listjobs(struct joblist_t *jobs, int full);
+void printtime(const struct timespec *start, const struct timespec *end,
+               const struct rusage *ru);
 void usage(void);
 
+/* parallel.h */
+int do_parallel(struct cmdline_t *cmd);
+int batchnext(struct job_t *job, pid_t pid);
+pid_t batchwait(int *status, struct rusage *ru);
+
+/* trace.h   */
+extern volatile sig_atomic_t tracing;
+void trace_event(int ev, int step, pid_t pid, jid_t jid);
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+void trace_dump(void);
+int do_trace(char **argv);
+
+/* cpu.h     */
+int cpu_parse(const char *s, cpu_set_t *set);
+void cpu_format(const cpu_set_t *set, char *buf, size_t size);
+int cpu_check(const char *s, const cpu_set_t *set);
+void cpu_place(struct cmdline_t *cmd);
+int do_cpu(char **argv);
+
+/* limit.h   */
+int lim_parse(char **argv, struct limit_t *limits, int *nlimits, int *show);
+int do_ulimit(char **argv);
+int lim_apply(const struct limit_t *limits, int n);
+int lim_merge(struct limit_t *out, const struct limit_t *limits, int n);
+
+/* timer.h   */
+int parseduration(const char *s, double *secs);
+int parsesignal(const char *s);
+void tm_add(struct job_t *job, double secs, int sig, double grace);
+void tm_expire(void);
+
+/* env.h     */
+size_t env_namelen(const char *s);
+int env_isassign(const char *word);
+const char *env_get(const char *name, size_t len);
+void env_assign(const char *word, int export);
+char **env_block(char **assigns, int n);
+int do_export(char **argv);
+int do_unset(char **argv);
+
+/* expand.h  */
+void ex_compile(struct cmdline_t *cmd, char **slot);
+void ex_expand(struct cmdline_t *cmd);
+
+/* glob.h    */
+int hasglob(const char *s);
+void gl_expand(struct cmdline_t *cmd);
+
+/* wait.h    */
+int do_wait(char **argv);
+
+/* history.h */
+void hist_init(int interactive);
+void hist_add(const char *cmdline, size_t len);
+int hist_expand(const char **cmdline, size_t *len);
+int do_history(char **argv);
+
+/* out.h     */
+void notify(const char *fmt, ...);
+void out_drain(void);
+void out_flush(void);
+void out_prompt(const char *prompt);
+void out_init(int prompting);
+
 /* job.h     */
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs);
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid);
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, jid_t jid);
+void initjobs(struct joblist_t *jobs);
+int addjob(struct joblist_t *jobs, pid_t pid, int state,
+           const char *cmdline, size_t len);
+void addmember(struct joblist_t *jobs, struct job_t *job, pid_t pid);
+void reservepids(struct joblist_t *jobs, struct job_t *job, int n);
+int dropmember(struct joblist_t *jobs, struct job_t *job, pid_t pid);
+int deletejob(struct joblist_t *jobs, pid_t pid);
+void jobended(struct job_t *job);
+int endstatus(pid_t pid, jid_t jid);
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state);
+void addusage(struct rusage *sum, const struct rusage *ru);
+pid_t fgpid(struct joblist_t *jobs);
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct joblist_t *jobs, jid_t jid);
+
+/* launch.h  */
+pid_t launch(struct proc_t *proc, sigset_t *mask);
+int launchpipe(struct cmdline_t *cmd, sigset_t *mask);
+int runbuiltin(struct cmdline_t *cmd);
+pid_t launchsafe(struct proc_t *proc, sigset_t *mask);
+
+/* zygote.h  */
+void zy_init(void);
+int zy_launch(struct proc_t *proc, sigset_t *mask, pid_t *pid);
+void zy_stop(void);
+
+/* arena.h   */
+void arena_reset(struct arena_t *arena, size_t size);
+void arena_init(struct arena_t *arena, size_t size);
+void *arena_alloc(struct arena_t *arena, size_t size);
+
+/* reader.h  */
+void rd_fd(struct reader_t *rd, int fd);
+void rd_string(struct reader_t *rd, const char *s, size_t len);
+void rd_file(struct reader_t *rd, const char *path);
+ssize_t rd_fill(struct reader_t *rd);
+int rd_ready(struct reader_t *rd);
+char *rd_line(struct reader_t *rd, size_t *len);
+
+/* path.h    */
+const char *pathlookup(const char *name);
+const char *pathfind(const char *name, struct lookup_t *lk);
+const char *pathreuse(const struct lookup_t *lk);
+const char *pathsearch(const char *path, const char *name, char *buf, size_t size);
+void pathforget(const char *name);
+void pathclear(void);
+void listpaths(void);
+
+/* flow.h    */
+void fl_eval(const char *line, size_t len);
+const char *fl_prompt(const char *prompt);
+int fl_end(void);
+
+/* linecache.h */
+int lc_parse(const char *cmdline, size_t len, struct cmdline_t *cmd);
+void lc_use(struct cmdline_t *cmd, const struct cmdline_t *parsed);
+int lc_known(const struct cmdline_t *cmd, const char *word);
+void lc_stats(void);
 
 /* wrapper.h */
 handler_t *Signal(int signum, handler_t *handler);
@@ -90,10 +422,10 @@ void Sigprocmask(int how, const sigset_t *set, sigset_t *oldset);
 pid_t Fork(void);
 ssize_t sio_puts(char *msg, int len);
 void Sio_error(char *msg, int len);
-void Execve(const char *filename, char *argv[], char *envp[]);
 void Setpgid(pid_t, pid_t group);
 void Kill(pid_t, int sig);
 void Sigsuspend(sigset_t const *mask);
 void Sigdelset(sigset_t *mask, int sig);
+void Pipe2(int fds[2], int flags);
 
 #endif /* header */
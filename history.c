@@ -0,0 +1,361 @@
+#include "header.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Command history
+ *
+ * History is one line per command in an append-only file,
+ *    $MPSH_HISTFILE or ~/.mpsh_history. At startup the file is
+ *    only mapped, not read; the index of entries is built by
+ *    one memchr pass the first time history is used. Each new
+ *    command is added with a single O_APPEND write, so shells
+ *    sharing the file never interleave their lines. Commands
+ *    other shells add later are seen at the next start.
+ *
+ * Entries point into the mapping, or, for this session's
+ *    commands, into blocks that are never moved. A chain links
+ *    every entry to the previous one starting with the same two
+ *    bytes, so !prefix only looks at likely matches.
+ *
+ * History is kept by interactive shells, and by any shell when
+ *    MPSH_HISTFILE is set.
+ */
+
+#define HISTFD      10              /* history file is kept above this */
+#define HISTBLOCK   65536           /* size of a session text block    */
+#define HISTBUCKETS 4096            /* prefix chains (power of 2)      */
+
+struct histent_t {                  /* A history entry           */
+  const char *text;                 /* command, no newline       */
+  size_t len;
+  int prev;                         /* older entry, same prefix  */
+};
+
+static int histfd = -1;             /* history file, or -1 if off */
+static const char *map;             /* the file, as it was mapped */
+static size_t maplen;
+static struct histent_t *ent;       /* entry i is number i + 1    */
+static int nent, entcap;
+static int indexed;                 /* map has been indexed       */
+static int heads[HISTBUCKETS];      /* newest entry of each chain */
+static char *block;                 /* session text               */
+static size_t blockused = HISTBLOCK;
+static char *expbuf;                /* last expanded line         */
+static size_t expsize;
+
+/* bucket - Chain of entries starting with the bytes at s */
+static int bucket(const char *s, size_t len)
+{
+    unsigned h = (unsigned char)s[0] * 31 + (len > 1 ? (unsigned char)s[1] : 0);
+
+    return h & (HISTBUCKETS - 1);
+}
+
+/* addent - Add an entry to the index */
+static void addent(const char *text, size_t len)
+{
+    struct histent_t *e;
+    int b = bucket(text, len);
+
+    if (nent == entcap) {
+        entcap = entcap ? entcap * 2 : 1024;
+        if ((e = realloc(ent, entcap * sizeof(*ent))) == NULL) {
+            unix_error("history error");
+        }
+        ent = e;
+    }
+    ent[nent].text = text;
+    ent[nent].len = len;
+    ent[nent].prev = heads[b];
+    heads[b] = nent++;
+}
+
+/* index - Index the mapped file, once */
+static void hist_index(void)
+{
+    const char *p = map, *end = map + maplen, *nl;
+    int i;
+
+    if (indexed) {
+        return;
+    }
+    indexed = 1;
+    for (i = 0; i < HISTBUCKETS; i++) {
+        heads[i] = -1;
+    }
+    while (p < end) {
+        if ((nl = memchr(p, '\n', end - p)) == NULL) {
+            nl = end;           /* a line another shell is writing */
+        }
+        if (nl > p) {
+            addent(p, nl - p);
+        }
+        p = nl + 1;
+    }
+}
+
+/*
+ * hist_init - Open and map the history file, if history is to
+ *    be kept: interactive says whether the shell is
+ */
+void hist_init(int interactive)
+{
+    const char *path = getenv("MPSH_HISTFILE"), *home;
+    char buf[MAXLINE];
+    struct stat st;
+    int fd;
+
+    if (path == NULL) {
+        if (!interactive || (home = getenv("HOME")) == NULL) {
+            return;
+        }
+        snprintf(buf, sizeof(buf), "%s/.mpsh_history", home);
+        path = buf;
+    }
+
+    fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("history: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    histfd = fcntl(fd, F_DUPFD_CLOEXEC, HISTFD);
+    close(fd);
+
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, histfd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+        }
+        else {
+            maplen = st.st_size;
+        }
+    }
+}
+
+/* hist_add - Add a command to the history, and to the file */
+void hist_add(const char *cmdline, size_t len)
+{
+    char *text;
+
+    if (histfd < 0) {
+        return;
+    }
+    while (len > 0 && isspace((unsigned char)cmdline[len-1])) {
+        len--;
+    }
+    if (len == 0) {
+        return;
+    }
+    hist_index();
+
+    /* Copy into the session's text, with the newline, and write
+     * the line out in one piece
+     */
+    if (len + 1 > HISTBLOCK) {
+        text = malloc(len + 1);
+    }
+    else {
+        if (blockused + len + 1 > HISTBLOCK) {
+            block = malloc(HISTBLOCK);
+            blockused = 0;
+        }
+        text = block ? block + blockused : NULL;
+        blockused += len + 1;
+    }
+    if (text == NULL) {
+        unix_error("history error");
+    }
+    memcpy(text, cmdline, len);
+    text[len] = '\n';
+    addent(text, len);
+
+    if (write(histfd, text, len + 1) < 0) {
+        printf("history: %s\n", strerror(errno));
+        close(histfd);
+        histfd = -1;
+    }
+}
+
+/* matches - Does entry i start with (or, if anywhere, contain) s? */
+static int matches(int i, const char *s, size_t len, int anywhere)
+{
+    if (ent[i].len < len) {
+        return 0;
+    }
+    if (anywhere) {
+        return memmem(ent[i].text, ent[i].len, s, len) != NULL;
+    }
+    return !memcmp(ent[i].text, s, len);
+}
+
+/*
+ * hist_find - Most recent entry starting with (or, if anywhere,
+ *    containing) the len bytes at s, or -1
+ */
+static int hist_find(const char *s, size_t len, int anywhere)
+{
+    int i;
+
+    if (!anywhere && len >= 2) {
+        for (i = heads[bucket(s, len)]; i >= 0; i = ent[i].prev) {
+            if (matches(i, s, len, 0)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    for (i = nent - 1; i >= 0; i--) {
+        if (matches(i, s, len, anywhere)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* expput - Append len bytes to the expanded line */
+static void expput(size_t *used, const char *s, size_t len)
+{
+    if (*used + len + 1 > expsize) {
+        expsize = (*used + len + 1) * 2;
+        if ((expbuf = realloc(expbuf, expsize)) == NULL) {
+            unix_error("history error");
+        }
+    }
+    memcpy(expbuf + *used, s, len);
+    *used += len;
+}
+
+/*
+ * hist_expand - Replace history references in the line at
+ *    *cmdline:
+ *
+ *    !!        the previous command
+ *    !n, !-n   command n, or the nth most recent
+ *    !prefix   the most recent command starting with prefix
+ *    !?text?   the most recent command containing text
+ *
+ *    A ! inside single quotes, or followed by a blank or =, is
+ *    left alone. An expanded line is echoed, and *cmdline and
+ *    *len are pointed at it. Returns -1, after printing an
+ *    error, if a reference matches nothing.
+ */
+int hist_expand(const char **cmdline, size_t *len)
+{
+    const char *p = *cmdline, *end = p + *len, *start, *word;
+    size_t used = 0, wlen;
+    int quoted = 0, found = 0, neg, i;
+    long n;
+
+    if (histfd < 0 || memchr(p, '!', *len) == NULL) {
+        return 0;
+    }
+    hist_index();
+
+    for (start = p; p < end; p++) {
+        if (*p == '\'') {
+            quoted = !quoted;
+        }
+        if (quoted || *p != '!' || p + 1 == end ||
+            strchr(" \t\n=", p[1])) {
+            continue;
+        }
+
+        expput(&used, start, p - start);
+        word = ++p;
+        if (*p == '!') {
+            i = nent - 1;
+            p++;
+        }
+        else if (*p == '?') {
+            for (word = ++p; p < end && *p != '?'; p++)
+                ;
+            i = hist_find(word, p - word, 1);
+            if (p < end) {
+                p++;
+            }
+        }
+        else if (*p == '-' || isdigit((unsigned char)*p)) {
+            /* The line need not end in a NUL, so no strtol */
+            neg = *p == '-';
+            for (n = 0, p += neg; p < end && isdigit((unsigned char)*p); p++) {
+                if (n <= nent) {
+                    n = n * 10 + (*p - '0');
+                }
+            }
+            i = neg ? nent - n : n - 1;
+        }
+        else {
+            while (p < end && !strchr(" \t\n|&<>'", *p)) {
+                p++;
+            }
+            i = hist_find(word, p - word, 0);
+        }
+
+        if (i < 0 || i >= nent) {
+            wlen = p - word;
+            printf("!%.*s: event not found\n", (int)wlen, word);
+            return -1;
+        }
+        expput(&used, ent[i].text, ent[i].len);
+        start = p--;
+        found = 1;
+    }
+
+    if (!found) {
+        return 0;
+    }
+    expput(&used, start, end - start);
+    expbuf[used] = '\0';
+    printf("%s\n", expbuf);
+
+    *cmdline = expbuf;
+    *len = used;
+    return 0;
+}
+
+/*
+ * do_history - Execute the builtin history command
+ *
+ *    history         list every entry
+ *    history n       list the last n entries
+ *    history -s text list the entries containing text
+ */
+int do_history(char **argv)
+{
+    int i, first = 0;
+    const char *s = NULL;
+    char *end;
+
+    if (histfd < 0) {
+        printf("history: history is off\n");
+        return 1;
+    }
+    hist_index();
+
+    if (argv[1] && !strcmp(argv[1], "-s")) {
+        if ((s = argv[2]) == NULL) {
+            printf("history: -s needs an argument\n");
+            return 1;
+        }
+    }
+    else if (argv[1]) {
+        i = strtol(argv[1], &end, 10);
+        if (*end || i < 0) {
+            printf("history: %s: numeric argument required\n", argv[1]);
+            return 1;
+        }
+        first = i < nent ? nent - i : 0;
+    }
+
+    for (i = first; i < nent; i++) {
+        if (s && !matches(i, s, strlen(s), 1)) {
+            continue;
+        }
+        printf("%5d  %.*s\n", i + 1, (int)ent[i].len, ent[i].text);
+    }
+    return 0;
+}
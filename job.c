@@ -1,135 +1,448 @@
 #include "header.h"
 
-extern jid_t nextjid;
 extern char verbose;
 
+/*
+ * The job table
+ *
+ * The job with JID j lives in slots[j-1], so lookups by JID are
+ *    a single index. Unused JIDs are kept in a min-heap so the
+ *    lowest free JID is always handed out next, and a PID index
+ *    (open addressed, linear probing) maps the PID of every live
+ *    member of every job to its JID.
+ *
+ * Only addjob, addmember and reservepids allocate. They run
+ *    with signals blocked, so sigchld_handler never sees the
+ *    table mid-growth, and dropmember and deletejob only touch
+ *    memory that is already allocated, which keeps them safe to
+ *    call from the handler. A parallel job starts new members
+ *    from the handler too: room for them is reserved when the
+ *    job is created, so adding them never allocates either.
+ */
+struct joblist_t jobs;
+
+#define DONESLOTS 64            /* ended jobs whose status is kept */
+
+struct done_t {                 /* An ended job, for wait          */
+  pid_t pid;                    /* its leader, 0 once collected    */
+  jid_t jid;
+  int status;
+};
+
+static struct done_t done[DONESLOTS];
+static unsigned ndone;
+
+/* pidhash - Home position of pid in the PID index */
+static int pidhash(struct joblist_t *jobs, pid_t pid)
+{
+    return (unsigned)pid * 2654435761u & (jobs->pidslots - 1);
+}
+
+/* pidfind - Position of pid in the PID index, or of the hole it belongs in */
+static int pidfind(struct joblist_t *jobs, pid_t pid)
+{
+    int i = pidhash(jobs, pid);
+
+    while (jobs->pidindex[i].jid != 0 && jobs->pidindex[i].pid != pid) {
+        i = (i + 1) & (jobs->pidslots - 1);
+    }
+    return i;
+}
+
+/* pidinsert - Map pid to jid in the PID index */
+static void pidinsert(struct joblist_t *jobs, pid_t pid, jid_t jid)
+{
+    struct pident_t *ent = &jobs->pidindex[pidfind(jobs, pid)];
+
+    ent->pid = pid;
+    ent->jid = jid;
+}
+
+/*
+ * pidremove - Empty position i of the PID index, shifting later
+ *    entries of the probe chain back so lookups stay correct
+ */
+static void pidremove(struct joblist_t *jobs, int i)
+{
+    struct pident_t moved;
+    int j;
+
+    jobs->pidindex[i].jid = 0;
+    for (j = (i + 1) & (jobs->pidslots - 1);
+         jobs->pidindex[j].jid != 0;
+         j = (j + 1) & (jobs->pidslots - 1)) {
+        moved = jobs->pidindex[j];
+        jobs->pidindex[j].jid = 0;
+        pidinsert(jobs, moved.pid, moved.jid);
+    }
+}
+
+/* pushjid - Return a JID to the free heap */
+static void pushjid(struct joblist_t *jobs, jid_t jid)
+{
+    int i = jobs->nfree++, parent;
+
+    while (i > 0 && jobs->freejids[parent = (i - 1) / 2] > jid) {
+        jobs->freejids[i] = jobs->freejids[parent];
+        i = parent;
+    }
+    jobs->freejids[i] = jid;
+}
+
+/* popjid - Take the lowest free JID from the heap */
+static jid_t popjid(struct joblist_t *jobs)
+{
+    jid_t jid = jobs->freejids[0], last = jobs->freejids[--jobs->nfree];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < jobs->nfree) {
+        if (child + 1 < jobs->nfree &&
+            jobs->freejids[child+1] < jobs->freejids[child]) {
+            child++;
+        }
+        if (last <= jobs->freejids[child]) {
+            break;
+        }
+        jobs->freejids[i] = jobs->freejids[child];
+        i = child;
+    }
+    jobs->freejids[i] = last;
+    return jid;
+}
+
+/*
+ * growjobs - Double the job table, adding the new JIDs to the
+ *    free heap. The PID index is sized by growpids.
+ */
+static void growjobs(struct joblist_t *jobs)
+{
+    int i, oldsize = jobs->size, size = oldsize ? oldsize * 2 : INITJOBS;
+    struct job_t *slots;
+    jid_t *freejids;
+
+    slots = realloc(jobs->slots, size * sizeof(*slots));
+    freejids = realloc(jobs->freejids, size * sizeof(*freejids));
+    if (!slots || !freejids) {
+        unix_error("growjobs error");
+    }
+
+    jobs->slots = slots;
+    jobs->freejids = freejids;
+    jobs->size = size;
+
+    for (i = oldsize; i < size; i++) {
+        slots[i].cmdline = NULL;
+        slots[i].cmdsize = 0;
+        slots[i].pids = NULL;
+        slots[i].pidcap = 0;
+        slots[i].batch = NULL;
+        clearjob(&slots[i]);
+        pushjid(jobs, i + 1);
+    }
+}
+
 /* clearjob - Clear the entries in a job struct */
 void clearjob(struct job_t *job)
 {
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
-    job->cmdline[0] = '\0';
+    job->npids = 0;
+    job->termsig = 0;
+    if (job->cmdline) {
+        job->cmdline[0] = '\0';
+    }
 }
 
 /* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs)
+void initjobs(struct joblist_t *jobs)
 {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++) {
-        clearjob(&jobs[i]);
+    memset(jobs, 0, sizeof(*jobs));
+    jobs->fg = -1;
+    jobs->pidslots = 2 * INITJOBS;
+    if ((jobs->pidindex = calloc(jobs->pidslots, sizeof(*jobs->pidindex))) == NULL) {
+        unix_error("initjobs error");
     }
+    growjobs(jobs);
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs)
+/*
+ * growpids - Make room for n more member PIDs in a job, and for
+ *    as many new entries in the PID index, which is kept at
+ *    most half full counting the entries reserved for batches
+ */
+static void growpids(struct joblist_t *jobs, struct job_t *job, int n)
 {
-    int i;
-    jid_t max = 0;
+    struct pident_t *old = jobs->pidindex;
+    int i, oldslots = jobs->pidslots, cap = job->pidcap;
+    pid_t *pids;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].jid > max) {
-            max = jobs[i].jid;
+    if (job->npids + n > cap) {
+        while (job->npids + n > cap) {
+            cap = cap ? cap * 2 : 1;
         }
+        if ((pids = realloc(job->pids, cap * sizeof(*pids))) == NULL) {
+            unix_error("growpids error");
+        }
+        job->pids = pids;
+        job->pidcap = cap;
+    }
+
+    if ((jobs->npidents + jobs->reserved + n) * 2 <= oldslots) {
+        return;
     }
-    return max;
+    while ((jobs->npidents + jobs->reserved + n) * 2 > jobs->pidslots) {
+        jobs->pidslots *= 2;
+    }
+    if ((jobs->pidindex = calloc(jobs->pidslots, sizeof(*old))) == NULL) {
+        unix_error("growpids error");
+    }
+    for (i = 0; i < oldslots; i++) {
+        if (old[i].jid != 0) {
+            pidinsert(jobs, old[i].pid, old[i].jid);
+        }
+    }
+    free(old);
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs,
+/* addjob - Add a job running the len-byte cmdline to the job list */
+int addjob(struct joblist_t *jobs,
            pid_t pid, int state,
-           char *cmdline)
+           const char *cmdline, size_t len)
 {
-    int i;
+    struct job_t *job;
 
     if (pid < 1) {
         return 0;
     }
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == 0) {
-            jobs[i].pid = pid;
-            jobs[i].state = state;
-            jobs[i].jid = nextjid;
-            nextjid++;
-            if (nextjid > MAXJOBS) {
-                nextjid = 1;
-            }
-            strcpy(jobs[i].cmdline, cmdline);
-            if (verbose) {
-                printf("Added job [%d] %d %s",
-                    jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-            }
-            return 1;
+    if (jobs->nfree == 0) {
+        growjobs(jobs);
+    }
+
+    job = &jobs->slots[popjid(jobs) - 1];
+    job->pid = pid;
+    job->jid = job - jobs->slots + 1;
+    job->pidfd = -1;
+    free(job->batch);           /* left by a parallel job */
+    job->batch = NULL;
+    job->timed = 0;
+    job->pinned = 0;
+    job->timerid = 0;
+    job->timedout = 0;
+    job->status = 0;
+    job->stats.started = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &job->stats.start);
+    memset(&job->stats.usage, 0, sizeof(job->stats.usage));
+    growpids(jobs, job, 1);
+    job->pids[job->npids++] = pid;
+    job->lastpid = pid;
+    setjobstate(jobs, job, state);
+
+    /* Command lines are sized to fit; a slot keeps its buffer
+     * when it is reused so deletejob never has to free it
+     */
+    if (len + 1 > job->cmdsize || job->cmdsize > 4 * (len + 1)) {
+        free(job->cmdline);
+        if ((job->cmdline = malloc(len + 1)) == NULL) {
+            unix_error("addjob error");
         }
+        job->cmdsize = len + 1;
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+    memcpy(job->cmdline, cmdline, len);
+    job->cmdline[len] = '\0';
+
+    pidinsert(jobs, pid, job->jid);
+    jobs->npidents++;
+
+    if (verbose) {
+        printf("Added job [%d] %d %s\n",
+            job->jid, job->pid, job->cmdline);
+    }
+    return 1;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid)
+/*
+ * addmember - Add another process to a job. The job's process
+ *    group is not changed; the caller puts pid into it. A
+ *    batch member uses up room set aside by reservepids.
+ */
+void addmember(struct joblist_t *jobs, struct job_t *job, pid_t pid)
 {
-    int i;
+    if (job->batch) {
+        jobs->reserved--;
+    }
+    else {
+        growpids(jobs, job, 1);
+    }
+    job->pids[job->npids++] = pid;
+    job->lastpid = pid;
+    pidinsert(jobs, pid, job->jid);
+    jobs->npidents++;
+}
 
-    if (pid < 1) {
-        return 0;
+/*
+ * reservepids - Set aside room for n more members of a batch
+ *    job, to be added later from the SIGCHLD handler. A batch
+ *    keeps room for as many members as it may run at once.
+ */
+void reservepids(struct joblist_t *jobs, struct job_t *job, int n)
+{
+    growpids(jobs, job, n);
+    jobs->reserved += n;
+}
+
+/*
+ * dropmember - Remove a reaped process from its job. Returns the
+ *    number of members the job still has.
+ */
+int dropmember(struct joblist_t *jobs, struct job_t *job, pid_t pid)
+{
+    int i, pos = pidfind(jobs, pid);
+
+    if (jobs->pidindex[pos].jid != job->jid) {
+        return job->npids;
+    }
+    pidremove(jobs, pos);
+    jobs->npidents--;
+    if (job->batch) {
+        jobs->reserved++;
     }
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            clearjob(&jobs[i]);
-            nextjid = maxjid(jobs)+1;
-            return 1;
+    for (i = 0; i < job->npids; i++) {
+        if (job->pids[i] == pid) {
+            job->pids[i] = job->pids[--job->npids];
+            break;
         }
     }
-    return 0;
+    return job->npids;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs)
+/*
+ * deletejob - Delete the job that process pid belongs to from
+ *    the job list, along with all of its remaining members
+ */
+int deletejob(struct joblist_t *jobs, pid_t pid)
 {
+    struct job_t *job;
     int i;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].state == FG) {
-            return jobs[i].pid;
-        }
+    if ((job = getjobpid(jobs, pid)) == NULL) {
+        return 0;
     }
-    return 0;
+
+    for (i = 0; i < job->npids; i++) {
+        pidremove(jobs, pidfind(jobs, job->pids[i]));
+    }
+    jobs->npidents -= job->npids;
+    if (job->batch) {
+        jobs->reserved -= job->batch->max + 1 - job->npids;
+        jobs->nbatches--;
+    }
+    pushjid(jobs, job->jid);
+    if (jobs->fg == job->jid - 1) {
+        jobs->fg = -1;
+    }
+    clearjob(job);
+    return 1;
 }
 
-/* getjobpid - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid)
+/*
+ * jobended - Remember the status of a job that has ended and is
+ *    about to be deleted, so a later wait can still collect it.
+ *    Only background (or stopped) jobs are kept, the last
+ *    DONESLOTS of them; a foreground job's status went to $?.
+ *    Async-signal-safe.
+ */
+void jobended(struct job_t *job)
 {
-    int i;
+    struct done_t *d;
 
-    if (pid < 1) {
-        return NULL;
+    if (job->state == FG) {
+        return;
     }
+    d = &done[ndone++ & (DONESLOTS - 1)];
+    d->pid = job->pid;
+    d->jid = job->jid;
+    d->status = job->status;
+}
+
+/*
+ * endstatus - The status of the most recently ended job led by
+ *    pid (or, if pid is 0, with JID jid), or -1 if none is
+ *    remembered. A status is only collected once.
+ */
+int endstatus(pid_t pid, jid_t jid)
+{
+    struct done_t *d;
+    unsigned i;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            return &jobs[i];
+    for (i = 0; i < DONESLOTS && i < ndone; i++) {
+        d = &done[(ndone - 1 - i) & (DONESLOTS - 1)];
+        if (d->pid != 0 && (pid ? d->pid == pid : d->jid == jid)) {
+            d->pid = 0;
+            return d->status;
         }
     }
-    return NULL;
+    return -1;
 }
 
-/* getjobjid - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, jid_t jid)
+/* setjobstate - Change the state of a job, tracking the FG job */
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state)
 {
-    int i;
+    job->state = state;
+    if (state == FG) {
+        jobs->fg = job - jobs->slots;
+    }
+    else if (jobs->fg == job - jobs->slots) {
+        jobs->fg = -1;
+    }
+}
 
-    if (jid < 1) {
+/*
+ * addusage - Add the resource usage of a reaped member to a
+ *    job's total. Peak RSS is the largest of any member's.
+ */
+void addusage(struct rusage *sum, const struct rusage *ru)
+{
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss) {
+        sum->ru_maxrss = ru->ru_maxrss;
+    }
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct joblist_t *jobs)
+{
+    if (jobs->fg < 0) {
+        return 0;
+    }
+    return jobs->slots[jobs->fg].pid;
+}
+
+/* getjobpid - Find a job (by the PID of any member) on the job list */
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid)
+{
+    jid_t jid;
+
+    if (pid < 1) {
         return NULL;
     }
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].jid == jid) {
-            return &jobs[i];
-        }
+    jid = jobs->pidindex[pidfind(jobs, pid)].jid;
+    return jid ? &jobs->slots[jid-1] : NULL;
+}
+
+/* getjobjid - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct joblist_t *jobs, jid_t jid)
+{
+    if (jid < 1 || jid > jobs->size || jobs->slots[jid-1].pid == 0) {
+        return NULL;
     }
-    return NULL;
+    return &jobs->slots[jid-1];
 }
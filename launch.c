@@ -0,0 +1,480 @@
+#include "header.h"
+
+extern char launch_mode;
+extern int laststatus;
+
+#define REDIRFDS 10             /* redirections name descriptors 0-9 */
+
+/*
+ * spawnjob - launch a child with posix_spawn
+ *
+ * glibc implements posix_spawn with clone(CLONE_VM|CLONE_VFORK),
+ *    so the shell's page tables are never copied and the cost of
+ *    a launch does not grow with the shell's RSS. The attributes
+ *    reproduce what the fork path does by hand in the child:
+ *    the process group, the caller's signal mask and the
+ *    descriptor moves that wire up pipes and redirections.
+ *
+ *    There is no attribute for a CPU mask, so the shell takes on
+ *    the child's mask for the length of the call and the child
+ *    inherits it.
+ */
+static pid_t spawnjob(struct proc_t *proc, sigset_t *mask)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    cpu_set_t saved;
+    pid_t pid;
+    int i, err;
+
+    if (proc->cpus) {
+        sched_getaffinity(0, sizeof(saved), &saved);
+        if (sched_setaffinity(0, sizeof(*proc->cpus), proc->cpus) < 0) {
+            return -1;
+        }
+    }
+
+    Sigemptyset(&defaults);
+    Sigaddset(&defaults, SIGINT);
+    Sigaddset(&defaults, SIGTSTP);
+    Sigaddset(&defaults, SIGCHLD);
+    Sigaddset(&defaults, SIGQUIT);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                    POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, proc->pgid);
+    posix_spawnattr_setsigmask(&attr, mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    posix_spawn_file_actions_init(&actions);
+    for (i = 0; i < proc->nmoves; i++) {
+        posix_spawn_file_actions_adddup2(&actions,
+            proc->moves[i].from, proc->moves[i].to);
+    }
+    for (i = 0; i < proc->nredirs; i++) {
+        posix_spawn_file_actions_adddup2(&actions,
+            proc->redir[i].from, proc->redir[i].fd);
+    }
+
+    err = posix_spawn(&pid, proc->path,
+                      proc->nmoves + proc->nredirs ? &actions : NULL,
+                      &attr, proc->argv, proc->envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (proc->cpus) {
+        sched_setaffinity(0, sizeof(saved), &saved);
+    }
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/*
+ * movefd - dup2 from onto to in a forked child. A descriptor
+ *    moved onto itself just loses its close-on-exec flag.
+ */
+static void movefd(int from, int to)
+{
+    if (from == to) {
+        fcntl(from, F_SETFD, 0);
+    }
+    else if (dup2(from, to) < 0) {
+        Sio_error("Dup2 error\n", 11);
+    }
+}
+
+/*
+ * highfd - Move fd to REDIRFDS or above, close-on-exec, clear
+ *    of the descriptors a child sets up
+ */
+static int highfd(int fd)
+{
+    int high;
+
+    if (fd < 0 || fd >= REDIRFDS) {
+        return fd;
+    }
+    high = fcntl(fd, F_DUPFD_CLOEXEC, REDIRFDS);
+    close(fd);
+    return high;
+}
+
+/*
+ * forkjob - launch a child with fork and execve
+ *
+ * This is the original launch path, kept as a fallback
+ *    for systems where posix_spawn is unavailable or
+ *    misbehaves (mpsh -f). The child shares the shell's
+ *    stdio state, so it reports errors with the sio
+ *    functions and leaves through _exit. A failed exec is
+ *    sent back over a close-on-exec pipe, as the zygote does,
+ *    so the shell sees its errno as it would from posix_spawn.
+ */
+static pid_t forkjob(struct proc_t *proc, sigset_t *mask)
+{
+    int i, err, errpipe[2];
+    ssize_t got;
+    pid_t pid;
+
+    if (pipe2(errpipe, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    errpipe[0] = highfd(errpipe[0]);
+    errpipe[1] = highfd(errpipe[1]);
+
+    /* Not Fork: a launch from the handler must not exit the shell */
+    if ((pid = fork()) < 0) {
+        err = errno;
+        close(errpipe[0]);
+        close(errpipe[1]);
+        errno = err;
+        return -1;
+    }
+    if (pid == CHILD) {
+        Sigprocmask(SIG_SETMASK, mask, NULL);
+        if (setpgid(0, proc->pgid) < 0) {
+            Sio_error("Setpgid error\n", 14);
+        }
+        if (proc->cpus &&
+            sched_setaffinity(0, sizeof(*proc->cpus), proc->cpus) < 0) {
+            Sio_error("Sched_setaffinity error\n", 24);
+        }
+        if (lim_apply(proc->limits, proc->nlimits) < 0) {
+            Sio_error("Setrlimit error\n", 16);
+        }
+        for (i = 0; i < proc->nmoves; i++) {
+            movefd(proc->moves[i].from, proc->moves[i].to);
+        }
+        for (i = 0; i < proc->nredirs; i++) {
+            movefd(proc->redir[i].from, proc->redir[i].fd);
+        }
+        execve(proc->path, proc->argv, proc->envp);
+        err = errno;
+        write(errpipe[1], &err, sizeof(err));
+        _exit(127);
+    }
+    close(errpipe[1]);
+
+    /* Also set the group from the parent, so a later pipeline
+     * stage can join it even if this child has not run yet
+     */
+    setpgid(pid, proc->pgid ? proc->pgid : pid);
+
+    /* EOF means the exec succeeded and closed the pipe */
+    while ((got = read(errpipe[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+    }
+    close(errpipe[0]);
+    if (got == sizeof(err)) {
+        waitpid(pid, NULL, 0);
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/*
+ * launch - Start proc->path with the signal mask set to mask,
+ *    using the configured launch mode. Requests the zygote
+ *    cannot take are spawned instead, and those with resource
+ *    limits, which posix_spawn cannot set, are forked. Returns
+ *    the child's PID, or -1 when the command could not be
+ *    started.
+ */
+pid_t launch(struct proc_t *proc, sigset_t *mask)
+{
+    pid_t pid;
+
+    if (launch_mode == LAUNCH_FORK) {
+        return forkjob(proc, mask);
+    }
+    if (launch_mode == LAUNCH_ZYGOTE && zy_launch(proc, mask, &pid) == 0) {
+        return pid;
+    }
+    if (proc->nlimits > 0) {
+        return forkjob(proc, mask);
+    }
+    return spawnjob(proc, mask);
+}
+
+/*
+ * launchsafe - Launch from a signal handler. fork and execve
+ *    are async-signal-safe and posix_spawn is not, so this
+ *    always takes the fork path, whatever the launch mode. A
+ *    failure is returned, never reported, for the caller to deal
+ *    with safely.
+ */
+pid_t launchsafe(struct proc_t *proc, sigset_t *mask)
+{
+    return forkjob(proc, mask);
+}
+
+/*
+ * assignedpath - The value of the last PATH= among the stage's
+ *    assignments, or NULL if it sets none
+ */
+static const char *assignedpath(const struct stage_t *stage)
+{
+    const char *path = NULL;
+    int i;
+
+    for (i = 0; i < stage->nassigns; i++) {
+        if (!strncmp(stage->assigns[i], "PATH=", 5)) {
+            path = stage->assigns[i] + 5;
+        }
+    }
+    return path;
+}
+
+/*
+ * startproc - Resolve proc->argv[0] on PATH and launch it. The
+ *    lookup is kept in lk, with the line, when the name is a
+ *    word of the line as parsed, and taken from there next time
+ *    while the path cache is unchanged. A cached location that
+ *    has disappeared is forgotten and PATH is searched once more.
+ *    A stage that assigns PATH is searched for on that, leaving
+ *    the cache alone.
+ */
+static pid_t startproc(struct proc_t *proc, sigset_t *mask, struct cmdline_t *cmd,
+                       const struct stage_t *stage, struct lookup_t *lk)
+{
+    char *name = proc->argv[0], buf[MAXLINE];
+    const char *path;
+    pid_t pid;
+
+    if ((path = assignedpath(stage)) != NULL) {
+        proc->path = pathsearch(path, name, buf, sizeof(buf));
+    }
+    else if (lk->name != name || (proc->path = pathreuse(lk)) == NULL) {
+        proc->path = pathfind(name, lc_known(cmd, name) ? lk : NULL);
+    }
+    if (proc->path == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    pid = launch(proc, mask);
+    Trace(TR_LAUNCH, 0, pid, 0);
+
+    if (pid < 0 && errno == ENOENT && proc->path != name && path == NULL) {
+        pathforget(name);
+        if ((proc->path = pathlookup(name)) != NULL) {
+            pid = launch(proc, mask);
+        }
+    }
+    return pid;
+}
+
+/*
+ * killstages - Undo a partly launched pipeline: kill the first
+ *    n stages of cmd, already running, and reap them before they
+ *    reach the job table. The caller holds SIGCHLD blocked.
+ */
+static void killstages(struct cmdline_t *cmd, int n)
+{
+    int i;
+
+    if (n == 0) {
+        return;
+    }
+    kill(-cmd->stage[0].pid, SIGKILL);
+    for (i = 0; i < n; i++) {
+        waitpid(cmd->stage[i].pid, NULL, 0);
+    }
+}
+
+/* closeredirs - Close the files opened for cmd's first n redirections */
+static void closeredirs(struct cmdline_t *cmd, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (cmd->redir[i].path) {
+            close(cmd->redir[i].from);
+        }
+    }
+}
+
+/*
+ * openredirs - Open the files named by cmd's redirections, all
+ *    close-on-exec, leaving each descriptor in its redirection's
+ *    from. The shell opens them, rather than each child, so that
+ *    a bad file is reported before any stage has been started;
+ *    the children only dup2 them into place. Returns 0, or -1
+ *    after printing an error, with nothing left open.
+ */
+static int openredirs(struct cmdline_t *cmd)
+{
+    struct redir_t *r;
+    int i, fd, high = 0;
+
+    for (i = 0; i < cmd->nredirs; i++) {
+        high |= cmd->redir[i].fd > STDERR_FILENO;
+    }
+
+    for (i = 0; i < cmd->nredirs; i++) {
+        r = &cmd->redir[i];
+        if (r->path == NULL) {
+            continue;
+        }
+
+        fd = open(r->path, r->flags | O_CLOEXEC, 0666);
+
+        /* Keep the file clear of the descriptors being set up */
+        if (fd >= 0 && fd < REDIRFDS && high) {
+            r->from = fcntl(fd, F_DUPFD_CLOEXEC, REDIRFDS);
+            close(fd);
+            fd = r->from;
+        }
+        if (fd < 0) {
+            printf("%s: %s\n", r->path, strerror(errno));
+            closeredirs(cmd, i);
+            return -1;
+        }
+        r->from = fd;
+    }
+    return 0;
+}
+
+/*
+ * launchpipe - Launch every stage of cmd in one process group,
+ *    connecting the stages with pipes. Each stage's PID is
+ *    stored in the stage, the first being the group leader.
+ *    Returns 0 on success. On failure nothing is left running,
+ *    an error has been printed and -1 is returned.
+ */
+int launchpipe(struct cmdline_t *cmd, sigset_t *mask)
+{
+    struct stage_t *stage;
+    struct proc_t proc;
+    int i, err, fds[2], in = -1;
+
+    if (openredirs(cmd) < 0) {
+        laststatus = 1;
+        return -1;
+    }
+
+    /* What the shell printed comes before anything the job prints */
+    out_flush();
+
+    for (i = 0; i < cmd->nstages; i++) {
+        stage = &cmd->stage[i];
+        proc.argv = &cmd->argv[stage->argv];
+        proc.pgid = i ? cmd->stage[0].pid : 0;
+        proc.nmoves = 0;
+
+        if (in >= 0) {
+            proc.moves[proc.nmoves].from = in;
+            proc.moves[proc.nmoves++].to = STDIN_FILENO;
+        }
+        if (i < cmd->nstages - 1) {
+            Pipe2(fds, O_CLOEXEC);
+            proc.moves[proc.nmoves].from = fds[1];
+            proc.moves[proc.nmoves++].to = STDOUT_FILENO;
+        }
+
+        /* Redirections apply after the pipes, in the order given */
+        proc.redir = &cmd->redir[stage->redir];
+        proc.nredirs = stage->nredirs;
+        proc.cpus = cmd->pinned ? &cmd->cpus : NULL;
+        proc.limits = cmd->limits;
+        proc.nlimits = cmd->nlimits;
+        proc.envp = env_block(stage->assigns, stage->nassigns);
+
+        stage->pid = startproc(&proc, mask, cmd, stage, &cmd->lookup[i]);
+        err = errno;
+
+        if (in >= 0) {
+            close(in);
+        }
+        if (i < cmd->nstages - 1) {
+            close(fds[1]);
+            in = fds[0];
+        }
+
+        if (stage->pid < 0) {
+            if (in >= 0 && i < cmd->nstages - 1) {
+                close(in);
+            }
+            killstages(cmd, i);
+            closeredirs(cmd, cmd->nredirs);
+            if (err == ENOENT) {
+                printf("%s: Command not found.\n", proc.argv[0]);
+            }
+            else {
+                printf("%s: %s\n", proc.argv[0], strerror(err));
+            }
+            laststatus = err == ENOENT ? 127 : 126;
+            return -1;
+        }
+    }
+    closeredirs(cmd, cmd->nredirs);
+    return 0;
+}
+
+/* restorefds - Undo the first n redirections applied by runbuiltin */
+static void restorefds(struct cmdline_t *cmd, int n)
+{
+    struct redir_t *r;
+
+    while (n-- > 0) {
+        r = &cmd->redir[n];
+        if (r->saved >= 0) {
+            dup2(r->saved, r->fd);
+            close(r->saved);
+        }
+        else {
+            close(r->fd);
+        }
+    }
+}
+
+/*
+ * runbuiltin - Run a builtin command. Builtins run in the shell
+ *    itself, so their redirections are applied to the shell's
+ *    own descriptors, which are saved first and put back once
+ *    the command returns. The builtin's status becomes the
+ *    last status. Returns -1 if a redirection failed and the
+ *    command was not run.
+ */
+int runbuiltin(struct cmdline_t *cmd)
+{
+    struct redir_t *r;
+    int i, err;
+
+    if (cmd->nredirs == 0) {
+        laststatus = builtin_cmd(cmd);
+        return 0;
+    }
+    if (openredirs(cmd) < 0) {
+        laststatus = 1;
+        return -1;
+    }
+
+    out_flush();
+    for (i = 0; i < cmd->nredirs; i++) {
+        r = &cmd->redir[i];
+        r->saved = fcntl(r->fd, F_DUPFD_CLOEXEC, REDIRFDS);
+        if (dup2(r->from, r->fd) < 0) {
+            err = errno;
+            restorefds(cmd, i + 1);
+            closeredirs(cmd, cmd->nredirs);
+            printf("%d: %s\n", r->from, strerror(err));
+            laststatus = 1;
+            return -1;
+        }
+    }
+    closeredirs(cmd, cmd->nredirs);
+
+    laststatus = builtin_cmd(cmd);
+
+    fflush(stdout);
+    restorefds(cmd, cmd->nredirs);
+    return 0;
+}
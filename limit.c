@@ -0,0 +1,238 @@
+#include "header.h"
+
+/*
+ * Resource limits (ulimit)
+ *
+ * `ulimit -v 100000` sets a limit on the shell itself, which
+ *    every later job inherits. Followed by a command, as in
+ *    `ulimit -v 100000 cmd &`, the limits are only set in that
+ *    job's processes, by the child just before it execs, so no
+ *    wrapper process is needed. Without -S or -H both the soft
+ *    and the hard limit are set.
+ *
+ * The zygote was started before any limit was set on the shell,
+ *    so the shell's limits are also kept here and sent with each
+ *    request it makes.
+ */
+
+#define LIM_SOFT 1              /* set the soft limit (-S) */
+#define LIM_HARD 2              /* set the hard limit (-H) */
+#define SHOWHARD (1 << NLIMITS) /* print hard limits (-H)  */
+
+struct limdef_t {               /* A limit ulimit knows     */
+  char opt;                     /* its option letter        */
+  int resource;                 /* RLIMIT_...               */
+  rlim_t unit;                  /* bytes per value unit     */
+  const char *name;
+};
+
+static const struct limdef_t limdefs[NLIMITS] = {
+    { 'c', RLIMIT_CORE,   1024, "core file size (kbytes)" },
+    { 'n', RLIMIT_NOFILE, 1,    "open files" },
+    { 't', RLIMIT_CPU,    1,    "cpu time (seconds)" },
+    { 'u', RLIMIT_NPROC,  1,    "max user processes" },
+    { 'v', RLIMIT_AS,     1024, "virtual memory (kbytes)" },
+};
+
+static struct limit_t shlimits[NLIMITS];   /* set on the shell */
+static int nshlimits;
+
+/*
+ * findentry - The entry for resource in limits[0..*n), added
+ *    (holding the current limits) if there is none
+ */
+static struct limit_t *findentry(struct limit_t *limits, int *n, int resource)
+{
+    struct limit_t *l;
+
+    for (l = limits; l < limits + *n; l++) {
+        if (l->resource == resource) {
+            return l;
+        }
+    }
+    (*n)++;
+    l->resource = resource;
+    getrlimit(resource, &l->rl);
+    return l;
+}
+
+/* findlim - The limit named by option word s, or -1 */
+static int findlim(const char *s)
+{
+    int k;
+
+    for (k = 0; s[0] == '-' && s[1] && !s[2] && k < NLIMITS; k++) {
+        if (s[1] == limdefs[k].opt) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* getvalue - Parse a limit value into *v. Returns -1 if s is not one. */
+static int getvalue(const char *s, const struct limdef_t *def, rlim_t *v)
+{
+    unsigned long long n;
+    char *end;
+
+    if (!strcmp(s, "unlimited")) {
+        *v = RLIM_INFINITY;
+        return 0;
+    }
+    if (!isdigit((unsigned char)*s)) {
+        return -1;
+    }
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if (*end || errno || n > RLIM_INFINITY / def->unit) {
+        return -1;
+    }
+    *v = n * def->unit;
+    return 0;
+}
+
+/*
+ * lim_parse - Parse the options of the ulimit command in argv
+ *    into the new limits in limits[0..*nlimits), and the limits
+ *    to print into the bits of *show (by limdefs index, with
+ *    SHOWHARD set for hard limits). Returns the index of the
+ *    first word after the options, or -1 after printing an
+ *    error.
+ */
+int lim_parse(char **argv, struct limit_t *limits, int *nlimits, int *show)
+{
+    struct limit_t *l;
+    int i, k, how = 0;
+    rlim_t v;
+
+    *nlimits = 0;
+    *show = 0;
+    for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-S")) {
+            how |= LIM_SOFT;
+            continue;
+        }
+        if (!strcmp(argv[i], "-H")) {
+            how |= LIM_HARD;
+            continue;
+        }
+        if (!strcmp(argv[i], "-a")) {
+            *show |= (1 << NLIMITS) - 1;
+            continue;
+        }
+        if ((k = findlim(argv[i])) < 0) {
+            printf("ulimit: %s: invalid option\n", argv[i]);
+            return -1;
+        }
+        if (argv[i+1] == NULL || getvalue(argv[i+1], &limdefs[k], &v) < 0) {
+            *show |= 1 << k;
+            continue;
+        }
+        i++;
+
+        /* A limit given twice keeps the last value */
+        l = findentry(limits, nlimits, limdefs[k].resource);
+        if (how != LIM_HARD) {
+            l->rl.rlim_cur = v;
+        }
+        if (how != LIM_SOFT) {
+            l->rl.rlim_max = v;
+        }
+        if (l->rl.rlim_cur > l->rl.rlim_max) {
+            printf("ulimit: %s: soft limit above hard limit\n", argv[i-1]);
+            return -1;
+        }
+    }
+    if (how == LIM_HARD) {
+        *show |= SHOWHARD;
+    }
+    return i;
+}
+
+/* printlim - Print limit k, the hard limit if hard is set */
+static void printlim(int k, int hard)
+{
+    struct rlimit rl;
+    rlim_t v;
+
+    getrlimit(limdefs[k].resource, &rl);
+    v = hard ? rl.rlim_max : rl.rlim_cur;
+    if (v == RLIM_INFINITY) {
+        printf("%-24s (-%c) unlimited\n", limdefs[k].name, limdefs[k].opt);
+    }
+    else {
+        printf("%-24s (-%c) %llu\n", limdefs[k].name, limdefs[k].opt,
+            (unsigned long long)(v / limdefs[k].unit));
+    }
+}
+
+/*
+ * do_ulimit - Execute the builtin ulimit command, which sets or
+ *    prints the shell's own limits (`ulimit ... cmd` is taken
+ *    off the command line by eval)
+ *
+ *    ulimit [-SH] [-a] [-c|-n|-t|-u|-v [value|unlimited]]...
+ */
+int do_ulimit(char **argv)
+{
+    struct limit_t limits[NLIMITS];
+    int i, k, n, show;
+
+    if ((i = lim_parse(argv, limits, &n, &show)) < 0) {
+        return 1;
+    }
+    if (argv[i] != NULL) {
+        printf("ulimit: %s: invalid limit\n", argv[i]);
+        return 1;
+    }
+
+    for (k = 0; k < n; k++) {
+        if (setrlimit(limits[k].resource, &limits[k].rl) < 0) {
+            printf("ulimit: %s\n", strerror(errno));
+            return 1;
+        }
+        *findentry(shlimits, &nshlimits, limits[k].resource) = limits[k];
+    }
+
+    if (n == 0 && (show & ~SHOWHARD) == 0) {
+        show |= (1 << NLIMITS) - 1;
+    }
+    for (k = 0; k < NLIMITS; k++) {
+        if (show & (1 << k)) {
+            printlim(k, show & SHOWHARD);
+        }
+    }
+    return 0;
+}
+
+/*
+ * lim_apply - Set the n limits in a child about to exec.
+ *    Async-signal-safe. Returns -1 if one could not be set.
+ */
+int lim_apply(const struct limit_t *limits, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (setrlimit(limits[i].resource, &limits[i].rl) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * lim_merge - Store in out the limits a child gets: the shell's
+ *    own, then the n given for its job. Returns the number
+ *    stored, at most NLIMITS.
+ */
+int lim_merge(struct limit_t *out, const struct limit_t *limits, int n)
+{
+    int i, nout = nshlimits;
+
+    memcpy(out, shlimits, nshlimits * sizeof(*out));
+    for (i = 0; i < n; i++) {
+        *findentry(out, &nout, limits[i].resource) = limits[i];
+    }
+    return nout;
+}
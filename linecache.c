@@ -0,0 +1,138 @@
+#include "header.h"
+
+/*
+ * Parsed line cache
+ *
+ * Scripts run the same lines over and over, so eval keeps the
+ *    parsed form of recent lines: argv, stages, redirections and
+ *    word templates, each line in an arena of its own with a
+ *    copy of its text. A line seen again is found by its hash
+ *    and compared, and is not parsed at all. The lookups made
+ *    for it, the builtin its command names and where PATH found
+ *    each stage's program, are kept with it too, and are used
+ *    again as long as the words are the ones parsed (not the
+ *    result of an expansion) and the command location cache has
+ *    not changed since.
+ *
+ * The cache holds LINESLOTS lines in sets of LINEWAYS; a new
+ *    line takes the place of the least recently used one in its
+ *    set. eval changes the stages of a line as it takes its
+ *    prefixes off, so each use gets a copy of them. Very long
+ *    lines and lines with syntax errors are not kept.
+ */
+
+#define LINESLOTS 512               /* lines kept (power of 2)    */
+#define LINEWAYS  4                 /* slots a line may go in     */
+#define LINEMAX   4096              /* longest line kept          */
+
+struct line_t {                     /* A cached line              */
+  size_t hash;                      /* of its text                */
+  unsigned long used;               /* tick of its last use       */
+  int bg;                           /* what parsein returned      */
+  struct arena_t arena;             /* text and parsed form, NULL */
+  struct cmdline_t cmd;             /*   base if the slot is free */
+};
+
+static struct line_t lines[LINESLOTS];
+static unsigned long tick, hits, misses;
+static struct stage_t *stages;      /* the copy eval works on     */
+static int stagecap;
+
+/* linehash - FNV-1a hash of the len bytes at s */
+static size_t linehash(const char *s, size_t len)
+{
+    size_t h = 2166136261u;
+
+    while (len-- > 0) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * lc_parse - Parse the len bytes of command line at cmdline into
+ *    cmd, as parseline does, taking the parsed form from the
+ *    cache if the line is there
+ */
+int lc_parse(const char *cmdline, size_t len, struct cmdline_t *cmd)
+{
+    struct line_t *l, *set, *victim = NULL;
+    size_t h;
+
+    if (len > LINEMAX) {
+        return parseline(cmdline, len, cmd);
+    }
+
+    h = linehash(cmdline, len);
+    set = &lines[h & (LINESLOTS - 1) & ~(LINEWAYS - 1)];
+    for (l = set; l < set + LINEWAYS; l++) {
+        if (l->arena.base && l->hash == h && l->cmd.len == len &&
+            !memcmp(l->cmd.text, cmdline, len)) {
+            break;
+        }
+        if (victim == NULL || l->used < victim->used) {
+            victim = l;
+        }
+    }
+
+    if (l < set + LINEWAYS) {
+        hits++;
+    }
+    else {
+        misses++;
+        l = victim;
+        free(l->arena.base);
+        l->arena.base = NULL;
+        l->used = 0;
+        if ((l->bg = parsein(cmdline, len, &l->cmd, &l->arena, 1)) < 0) {
+            free(l->arena.base);
+            l->arena.base = NULL;
+            return -1;
+        }
+        l->hash = h;
+    }
+    l->used = ++tick;
+    lc_use(cmd, &l->cmd);
+    return l->bg;
+}
+
+/*
+ * lc_use - Make cmd a copy of parsed, kept by its owner, to be
+ *    run once: the words and lookups are shared, the stages,
+ *    which eval changes, are copied
+ */
+void lc_use(struct cmdline_t *cmd, const struct cmdline_t *parsed)
+{
+    struct stage_t *s;
+
+    if (parsed->nstages > stagecap) {
+        stagecap = parsed->nstages * 2;
+        if ((s = realloc(stages, stagecap * sizeof(*stages))) == NULL) {
+            unix_error("lc_use error");
+        }
+        stages = s;
+    }
+    *cmd = *parsed;
+    cmd->stage = memcpy(stages, parsed->stage, parsed->nstages * sizeof(*stages));
+}
+
+/*
+ * lc_known - Is word one that was parsed for cmd, so that what
+ *    is looked up for it may be kept with the line?
+ */
+int lc_known(const struct cmdline_t *cmd, const char *word)
+{
+    return word >= cmd->words && word < cmd->words + cmd->wordsize;
+}
+
+/* lc_stats - Print how well the cache is doing */
+void lc_stats(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < LINESLOTS; i++) {
+        n += lines[i].arena.base != NULL;
+    }
+    printf("lines: %d cached, %lu hits, %lu misses\n", n, hits, misses);
+}
@@ -15,17 +15,21 @@
 extern char **environ;              /* defined in libc                     */
 char promt[] = "mpsh> ";            /* command line prompt (DO NOT CHANGE) */
 char verbose = 0;                   /* if true, print additional output    */
-jid_t nextjid = 1;                  /* next job ID to allocate             */
 char sbuf[MAXLINE];                 /* for composing sprintf messages      */
-volatile int logger = 0;            /* if true, print logging messages     */
+char launch_mode = LAUNCH_SPAWN;    /* how external commands are started   */
 
 volatile sig_atomic_t atomic_fggpid = 0;
+extern int laststatus;
 
 int main(int argc, char **argv)
 {
     char c;
-    char cmdline[MAXLINE];
+    char *line;
+    char *command = NULL;    /* mpsh -c command      */
+    size_t len;
+    struct reader_t rd;      /* where commands come from */
     char emit_prompt = 1;    /* emit promt (default) */
+    char use_evloop = 0;     /* signalfd/epoll loop  */
 
     /* Redirect stderr to stdout (so that the driver will)
      * get all output on the pipe connected
@@ -34,7 +38,7 @@ int main(int argc, char **argv)
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvpl")) != EOF) {
+    while ((c = getopt(argc, argv, "hvplfezc:")) != EOF) {
         switch (c) {
             case 'h':             /* print help message */
                 usage();
@@ -45,48 +49,79 @@ int main(int argc, char **argv)
             case 'p':             /* don't print a promt */
                 emit_prompt = 0;  /* handy for automatic testing */
                 break;
-            case 'l':
-                logger = ~0;
+            case 'l':             /* trace events, dump them on exit */
+                trace_start();
+                atexit(trace_dump);
+                break;
+            case 'f':             /* launch with fork/execve */
+                launch_mode = LAUNCH_FORK;
+                break;
+            case 'z':             /* launch through the zygote */
+                launch_mode = LAUNCH_ZYGOTE;
+                break;
+            case 'e':             /* run on the event loop */
+                use_evloop = 1;
+                break;
+            case 'c':             /* run the given commands */
+                command = optarg;
                 break;
             default:
                 usage();
         }
     }
 
+    /* Start the zygote while the shell is still small */
+    if (launch_mode == LAUNCH_ZYGOTE) {
+        zy_init();
+    }
+
+    /* Scripts and -c commands are run without prompts */
+    if (command) {
+        rd_string(&rd, command, strlen(command));
+        emit_prompt = 0;
+    }
+    else if (optind < argc) {
+        rd_file(&rd, argv[optind]);
+        emit_prompt = 0;
+    }
+    else {
+        rd_fd(&rd, STDIN_FILENO);
+    }
+
+    out_init(emit_prompt);
+    hist_init(emit_prompt);
+
     /* Install the signal handlers */
 
     Signal(SIGINT, sigint_handler);     /* ctrl-c */
     Signal(SIGTSTP, sigtstp_handler);   /* ctrl-z */
     Signal(SIGCHLD, sigchld_handler);   /* Terminated or stopped child */
+    Signal(SIGALRM, sigalrm_handler);   /* A job's timeout is up */
 
     /* Provides a clean way to kill the shell */
     Signal(SIGQUIT, sigquit_handler);
 
     /* Initialize the job list */
-    initjobs(jobs);
+    initjobs(&jobs);
+
+    /* Opt-in event loop core: never returns */
+    if (use_evloop) {
+        ev_init();
+        ev_run(&rd, emit_prompt);
+    }
 
     /* Execute the shell's read/eval loop */
     while (TRUE) {
 
         /* Read command line */
-        if (emit_prompt) {
-            printf("%s", promt);
-            fflush(stdout);
-        }
-
-        if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin)) {
-            app_error("fgets error");
-        }
+        out_prompt(emit_prompt ? fl_prompt(promt) : NULL);
 
-        if (feof(stdin)) {    /* End of file (ctrl-d) */
-            fflush(stdout);
-            exit(0);
+        if ((line = rd_line(&rd, &len)) == NULL) {    /* End of file (ctrl-d) */
+            exit(fl_end());
         }
 
         /* Evaluate the command line */
-        eval(cmdline);
-        fflush(stdout);
-        fflush(stdout);
+        fl_eval(line, len);
     }
 
     exit(0);    /* control never reaches here */
@@ -0,0 +1,196 @@
+#include "header.h"
+#include <stdarg.h>
+
+/*
+ * Shell output
+ *
+ * Job notifications ("Job [1] (42) stopped by signal 20", time
+ *    reports) are raised by reapchild, which runs in the SIGCHLD
+ *    handler, where stdio must not be used. They are formatted
+ *    with a small async-signal-safe formatter into a lock-free
+ *    queue of fixed-size records instead, and copied into stdout
+ *    from normal context at safe points: before each prompt or
+ *    command is read, and when waitfg returns. A full queue
+ *    falls back to writing the record directly.
+ *
+ * stdout itself is fully buffered. An interactive shell writes
+ *    it out at every prompt; otherwise it is only written when
+ *    the buffer fills, before a child is started (so the child's
+ *    output lands after the shell's) and at exit, so a script
+ *    of builtins costs one write per buffer, not one per line.
+ */
+
+#define NOTESLOTS 256               /* queued records (power of 2) */
+#define NOTEMAX   128               /* longest record, in bytes    */
+#define OUTBUFSIZE 65536            /* stdout buffer               */
+
+struct note_t {                     /* A queued notification  */
+  volatile sig_atomic_t ready;      /* filled, not yet drained */
+  int len;                          /* bytes in text           */
+  char text[NOTEMAX];
+};
+
+static struct note_t notes[NOTESLOTS];
+static unsigned nhead;              /* next record to drain    */
+static unsigned ntail;              /* next record to fill     */
+static int interactive;             /* flush at every prompt   */
+static char outbuf[OUTBUFSIZE];
+
+/*
+ * fmtnum - Format n in base 10 at the end of buf[0..*len),
+ *    right aligned in width, padded with pad
+ */
+static void fmtnum(char *buf, int *len, int size, long n, int width, char pad)
+{
+    char digits[24];
+    unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    int i = 0;
+
+    do {
+        digits[i++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0) {
+        if (pad == '0' && *len < size) {
+            buf[(*len)++] = '-';
+        }
+        else {
+            digits[i++] = '-';
+        }
+        width--;
+    }
+    for (; width > i && *len < size; width--) {
+        buf[(*len)++] = pad;
+    }
+    while (i > 0 && *len < size) {
+        buf[(*len)++] = digits[--i];
+    }
+}
+
+/*
+ * sio_vformat - vsnprintf for signal handlers: %d, %ld, %s,
+ *    %c and %%, with an optional 0 flag and width. Returns the
+ *    length, truncated to size.
+ */
+static int sio_vformat(char *buf, int size, const char *fmt, va_list ap)
+{
+    int len = 0, width;
+    const char *s;
+    char pad;
+
+    for (; *fmt && len < size; fmt++) {
+        if (*fmt != '%') {
+            buf[len++] = *fmt;
+            continue;
+        }
+        pad = *++fmt == '0' ? '0' : ' ';
+        for (width = 0; isdigit((unsigned char)*fmt); fmt++) {
+            width = width * 10 + *fmt - '0';
+        }
+        switch (*fmt) {
+            case 'd':
+                fmtnum(buf, &len, size, va_arg(ap, int), width, pad);
+                break;
+            case 'l':
+                fmt++;          /* %ld */
+                fmtnum(buf, &len, size, va_arg(ap, long), width, pad);
+                break;
+            case 's':
+                for (s = va_arg(ap, const char *); *s && len < size; s++) {
+                    buf[len++] = *s;
+                }
+                break;
+            case 'c':
+                buf[len++] = (char)va_arg(ap, int);
+                break;
+            case '%':
+                buf[len++] = '%';
+                break;
+            default:
+                return len;
+        }
+    }
+    return len;
+}
+
+/*
+ * notify - Queue a message for the terminal. Async-signal-safe:
+ *    handlers only ever interrupt the main program, so a record
+ *    claimed here is always finished before anything else can
+ *    look at the queue again.
+ */
+void notify(const char *fmt, ...)
+{
+    unsigned n = ntail;
+    struct note_t *note;
+    char buf[NOTEMAX];
+    va_list ap;
+    int len;
+
+    do {
+        if (n - nhead >= NOTESLOTS) {
+            va_start(ap, fmt);
+            len = sio_vformat(buf, sizeof(buf), fmt, ap);
+            va_end(ap);
+            sio_puts(buf, len);     /* queue full */
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ntail, &n, n + 1, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    note = &notes[n & (NOTESLOTS - 1)];
+    va_start(ap, fmt);
+    note->len = sio_vformat(note->text, NOTEMAX, fmt, ap);
+    va_end(ap);
+    note->ready = 1;
+}
+
+/* out_drain - Move the queued notifications into stdout */
+void out_drain(void)
+{
+    struct note_t *note;
+
+    while (nhead != ntail) {
+        note = &notes[nhead & (NOTESLOTS - 1)];
+        if (!note->ready) {
+            break;
+        }
+        fwrite(note->text, 1, note->len, stdout);
+        note->ready = 0;
+        nhead++;
+    }
+}
+
+/* out_flush - Write out everything the shell has printed so far */
+void out_flush(void)
+{
+    out_drain();
+    fflush(stdout);
+}
+
+/*
+ * out_prompt - A safe point between commands: print the pending
+ *    notifications, then prompt (if not NULL), and write it all
+ *    out if the shell is interactive
+ */
+void out_prompt(const char *prompt)
+{
+    out_drain();
+    if (prompt) {
+        fputs(prompt, stdout);
+    }
+    if (interactive) {
+        fflush(stdout);
+    }
+}
+
+/*
+ * out_init - Set up stdout. The shell is interactive if it
+ *    prompts or writes to a terminal.
+ */
+void out_init(int prompting)
+{
+    interactive = prompting || isatty(STDOUT_FILENO);
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    atexit(out_flush);
+}
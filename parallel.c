@@ -0,0 +1,496 @@
+#include "header.h"
+
+extern char **environ;
+extern volatile sig_atomic_t atomic_fggpid;
+extern char evloop;
+extern int laststatus;
+
+/*
+ * parallel - Run one command over many arguments, N at a time
+ *
+ *    parallel [-j N] command [arg...] ::: arg...
+ *    parallel [-j N] command [arg...] < file
+ *
+ * Each argument after ::: (or each line of stdin, when there
+ *    is no ::: and stdin is redirected with <) makes one instance
+ *    of the command, with every {} in its words replaced by the
+ *    argument, or the argument added at the end if there is no
+ *    {}. All instances belong to one job, in one process group,
+ *    so jobs, fg, bg, ctrl-c and ctrl-z act on the whole batch,
+ *    as do the time, cpu, ulimit and timeout prefixes.
+ *    At most N (default: the number of CPUs) run at once;
+ *    whenever one ends, the next is started from the SIGCHLD
+ *    handler.
+ *
+ * The process group lives as long as any member, even one that
+ *    has exited but not been reaped. So while batches run, a
+ *    child that has exited is looked at before it is reaped,
+ *    and if it is the last instance running, the next one is
+ *    started first, into the group it still holds open.
+ *
+ * Everything the handler needs is prepared up front in one
+ *    block: the resolved command, the argument vector of every
+ *    instance, and copies of the stdio descriptors the builtin
+ *    was run with, so later instances see the same redirections
+ *    as the first ones.
+ */
+
+#define BATCHFDS 10                 /* stdio copies are kept above this */
+
+/* usage_parallel - Report bad parallel arguments */
+static void usage_parallel(void)
+{
+    printf("parallel: usage: parallel [-j N] command [arg...] ::: arg...\n");
+    printf("       or: parallel [-j N] command [arg...] < file\n");
+}
+
+/* countsubs - Number of {} in word */
+static int countsubs(const char *word)
+{
+    int n = 0;
+
+    while ((word = strstr(word, "{}")) != NULL) {
+        word += 2;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * subst - Copy word to *out with each {} replaced by arg, and
+ *    return the copy
+ */
+static char *subst(const char *word, const char *arg, size_t arglen, char **out)
+{
+    char *copy = *out, *p = copy;
+    const char *brace;
+
+    while ((brace = strstr(word, "{}")) != NULL) {
+        memcpy(p, word, brace - word);
+        p += brace - word;
+        memcpy(p, arg, arglen);
+        p += arglen;
+        word = brace + 2;
+    }
+    strcpy(p, word);
+    *out = p + strlen(word) + 1;
+    return copy;
+}
+
+/* copystr - Copy s to *out and return the copy */
+static char *copystr(const char *s, char **out)
+{
+    char *copy = *out;
+    size_t n = strlen(s) + 1;
+
+    memcpy(copy, s, n);
+    *out += n;
+    return copy;
+}
+
+/*
+ * newbatch - Build the batch for running the ntmpl words of
+ *    tmpl (resolved to path) over the nargs arguments in args,
+ *    as one malloc'd block
+ */
+static struct batch_t *newbatch(const char *path, char **tmpl, int ntmpl,
+                                char **args, int nargs)
+{
+    struct batch_t *b;
+    size_t size, arglen;
+    int i, j, nsubs = 0, width;
+    char **argv, *out;
+
+    for (j = 0; j < ntmpl; j++) {
+        nsubs += countsubs(tmpl[j]);
+    }
+    width = ntmpl + (nsubs ? 1 : 2);    /* words, the argument, NULL */
+
+    /* The pointers come first, then the strings */
+    size = sizeof(*b) + nargs * sizeof(char **) +
+           (size_t)nargs * width * sizeof(char *) + strlen(path) + 1;
+    for (j = 0; j < ntmpl; j++) {
+        size += strlen(tmpl[j]) + 1;
+    }
+    for (i = 0; i < nargs; i++) {
+        arglen = strlen(args[i]);
+        size += arglen + 1;
+        for (j = 0; nsubs && j < ntmpl; j++) {
+            size += strlen(tmpl[j]) + 1 + countsubs(tmpl[j]) * arglen;
+        }
+    }
+
+    if ((b = malloc(size)) == NULL) {
+        unix_error("parallel error");
+    }
+    b->argvs = (char ***)(b + 1);
+    argv = (char **)(b->argvs + nargs);
+    out = (char *)(argv + (size_t)nargs * width);
+
+    b->path = copystr(path, &out);
+    for (j = 0; j < ntmpl; j++) {
+        tmpl[j] = copystr(tmpl[j], &out);
+    }
+
+    for (i = 0; i < nargs; i++, argv += width) {
+        b->argvs[i] = argv;
+        arglen = strlen(args[i]);
+        for (j = 0; j < ntmpl; j++) {
+            argv[j] = countsubs(tmpl[j]) ? subst(tmpl[j], args[i], arglen, &out)
+                                         : tmpl[j];
+        }
+        if (nsubs == 0) {
+            argv[j++] = copystr(args[i], &out);
+        }
+        argv[j] = NULL;
+    }
+
+    b->ninst = nargs;
+    b->next = 0;
+    b->ahead = 0;
+    return b;
+}
+
+/*
+ * readargs - Read stdin to the end and split it into lines,
+ *    one argument each. Returns the array of arguments and sets
+ *    *nargs; the text they point into is left in *text.
+ */
+static char **readargs(int *nargs, char **text)
+{
+    size_t len = 0, size = 1 << 12, i;
+    char *buf, **args, *line;
+    ssize_t n;
+    int count = 0;
+
+    if ((buf = malloc(size)) == NULL) {
+        unix_error("parallel error");
+    }
+    while ((n = read(STDIN_FILENO, buf + len, size - len - 1)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("parallel: read error");
+        }
+        len += n;
+        if (len + 1 == size && (buf = realloc(buf, size *= 2)) == NULL) {
+            unix_error("parallel error");
+        }
+    }
+    if (len > 0 && buf[len-1] != '\n') {
+        buf[len++] = '\n';
+    }
+
+    for (i = 0; i < len; i++) {
+        count += buf[i] == '\n';
+    }
+    if ((args = malloc((count + 1) * sizeof(char *))) == NULL) {
+        unix_error("parallel error");
+    }
+
+    for (i = 0, count = 0, line = buf; i < len; i++) {
+        if (buf[i] == '\n') {
+            buf[i] = '\0';
+            args[count++] = line;
+            line = buf + i + 1;
+        }
+    }
+    *nargs = count;
+    *text = buf;
+    return args;
+}
+
+/*
+ * startinst - Start the batch's next instance in process group
+ *    pgid (0 for a new group). From the SIGCHLD handler only
+ *    async-signal-safe launching is allowed.
+ */
+static pid_t startinst(struct batch_t *b, pid_t pgid, int inhandler)
+{
+    struct proc_t proc;
+    pid_t pid;
+
+    proc.path = b->path;
+    proc.argv = b->argvs[b->next++];
+    proc.pgid = pgid;
+    proc.nmoves = 0;
+    proc.redir = b->stdio;
+    proc.nredirs = 3;
+    proc.cpus = b->pinned ? &b->cpus : NULL;
+    proc.limits = b->limits;
+    proc.nlimits = b->nlimits;
+    proc.envp = environ;
+
+    pid = inhandler ? launchsafe(&proc, &b->mask) : launch(&proc, &b->mask);
+    Trace(TR_LAUNCH, 1 + inhandler, pid, 0);
+    return pid;
+}
+
+/* closestdio - Drop the batch's stdio copies once nothing more will start */
+static void closestdio(struct batch_t *b)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (b->stdio[i].from >= 0) {
+            close(b->stdio[i].from);
+            b->stdio[i].from = -1;
+        }
+    }
+}
+
+/*
+ * batchfail - An instance of job could not be started, for
+ *    reason err: start no more, report it and have the job
+ *    fail. Async-signal-safe.
+ */
+static void batchfail(struct job_t *job, int err)
+{
+    struct batch_t *b = job->batch;
+
+    b->next = b->ninst;
+    closestdio(b);
+    job->status = err == ENOENT ? 127 : 126;
+    notify("parallel: %s: cannot start: %s\n", b->argvs[0][0],
+           strerrorname_np(err));
+}
+
+/*
+ * batchahead - Called before child pid, which exited (killed if
+ *    by a signal), is reaped: if it is the last instance of its
+ *    batch still running and there is more to do, start the next
+ *    one now, while the zombie keeps the job's process group in
+ *    being. batchnext then only drops pid.
+ */
+static void batchahead(pid_t pid, int killed)
+{
+    struct job_t *job = getjobpid(&jobs, pid);
+    struct batch_t *b;
+    pid_t newpid;
+
+    if (job == NULL || (b = job->batch) == NULL || job->npids > 1 ||
+        killed || job->termsig || b->next >= b->ninst) {
+        return;
+    }
+    if ((newpid = startinst(b, job->pid, !evloop)) < 0) {
+        batchfail(job, errno);
+        return;
+    }
+    addmember(&jobs, job, newpid);
+    b->ahead = pid;
+}
+
+/*
+ * batchwait - Reap a child, as wait4(-1, status, WNOHANG |
+ *    WUNTRACED, ru) does, giving batchahead a look at one that
+ *    has exited first while any batch is running. Called with
+ *    every signal blocked, or from normal context by the event
+ *    loop.
+ */
+pid_t batchwait(int *status, struct rusage *ru)
+{
+    siginfo_t info;
+
+    if (jobs.nbatches > 0) {
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+            info.si_pid > 0) {
+            batchahead(info.si_pid, info.si_code != CLD_EXITED);
+            return wait4(info.si_pid, status, 0, ru);
+        }
+    }
+    return wait4(-1, status, WNOHANG | WUNTRACED, ru);
+}
+
+/*
+ * batchnext - Called by reapchild when member pid of a batch
+ *    job has terminated: replace it with the next instance, in
+ *    the job's process group, unless batchahead already has.
+ *    Returns 1 if pid was replaced, 0 if the batch is out of
+ *    work (or was killed) and pid should be reaped as usual.
+ */
+int batchnext(struct job_t *job, pid_t pid)
+{
+    struct batch_t *b = job->batch;
+    pid_t newpid;
+
+    if (b->ahead == pid) {
+        b->ahead = 0;
+        dropmember(&jobs, job, pid);
+        return 1;
+    }
+
+    /* Without other members the group went with pid */
+    if (job->termsig || job->npids == 1) {
+        b->next = b->ninst;
+    }
+    if (b->next >= b->ninst) {
+        closestdio(b);
+        return 0;
+    }
+
+    if ((newpid = startinst(b, job->pid, !evloop)) < 0) {
+        batchfail(job, errno);
+        return 0;
+    }
+
+    dropmember(&jobs, job, pid);
+    addmember(&jobs, job, newpid);
+    return 1;
+}
+
+/* stdinredirected - Does cmd redirect the shell's stdin? */
+static int stdinredirected(const struct cmdline_t *cmd)
+{
+    int i;
+
+    for (i = 0; i < cmd->nredirs; i++) {
+        if (cmd->redir[i].fd == STDIN_FILENO) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* do_parallel - Execute the builtin parallel command, returning its status */
+int do_parallel(struct cmdline_t *cmd)
+{
+    char **argv = cmd->argv, **args, **input = NULL, *text = NULL;
+    int i, tmpl, ntmpl, nargs, max;
+    sigset_t mask_all, mask_one, prev_one;
+    struct batch_t *b;
+    struct job_t *job;
+    const char *path;
+    char *end;
+    pid_t pid;
+
+    /* -j N, -jN */
+    max = sysconf(_SC_NPROCESSORS_ONLN);
+    tmpl = 1;
+    if (argv[1] && !strncmp(argv[1], "-j", 2)) {
+        const char *n = argv[1][2] ? argv[1] + 2 : argv[2];
+
+        tmpl = argv[1][2] ? 2 : 3;
+        if (n == NULL || (max = strtol(n, &end, 10)) < 1 || *end) {
+            printf("parallel: -j needs a positive number\n");
+            return 1;
+        }
+    }
+
+    for (ntmpl = 0; argv[tmpl + ntmpl] && strcmp(argv[tmpl + ntmpl], ":::"); ntmpl++)
+        ;
+    if (ntmpl == 0) {
+        usage_parallel();
+        return 1;
+    }
+
+    /* The arguments follow :::, or are read from stdin, but only
+     * when it is redirected: otherwise it is the shell's own input
+     */
+    if (argv[tmpl + ntmpl]) {
+        args = &argv[tmpl + ntmpl + 1];
+        for (nargs = 0; args[nargs]; nargs++)
+            ;
+    }
+    else if (stdinredirected(cmd)) {
+        args = input = readargs(&nargs, &text);
+    }
+    else {
+        usage_parallel();
+        return 1;
+    }
+
+    /* Instances are started from the handler, which cannot go
+     * back to PATH, so a cached location is checked first
+     */
+    path = nargs ? pathlookup(argv[tmpl]) : NULL;
+    if (path && path != argv[tmpl] && access(path, X_OK) < 0) {
+        pathforget(argv[tmpl]);
+        path = pathlookup(argv[tmpl]);
+    }
+    if (nargs && path == NULL) {
+        printf("%s: Command not found.\n", argv[tmpl]);
+    }
+    b = path ? newbatch(path, &argv[tmpl], ntmpl, args, nargs) : NULL;
+    free(input);
+    free(text);
+    if (b == NULL) {
+        return nargs ? 1 : 0;
+    }
+    b->max = max < nargs ? max : nargs;
+    for (i = 0; i < 3; i++) {
+        b->stdio[i].fd = i;
+        b->stdio[i].path = NULL;
+        if ((b->stdio[i].from = fcntl(i, F_DUPFD_CLOEXEC, BATCHFDS)) < 0) {
+            b->stdio[i].from = i;   /* closed; the dup2 reports it */
+        }
+    }
+
+    Sigfillset(&mask_all);
+    Sigemptyset(&mask_one);
+    Sigaddset(&mask_one, SIGCHLD);
+
+    out_flush();
+    lockjobs(&mask_one, &prev_one);
+    b->mask = prev_one;
+
+    /* The prefixes eval took off apply to every instance */
+    cpu_place(cmd);
+    b->pinned = cmd->pinned;
+    b->cpus = cmd->cpus;
+    memcpy(b->limits, cmd->limits, cmd->nlimits * sizeof(*cmd->limits));
+    b->nlimits = cmd->nlimits;
+
+    if ((pid = startinst(b, 0, 0)) < 0) {
+        printf("%s: %s\n", argv[tmpl], strerror(errno));
+        unlockjobs(&prev_one);
+        closestdio(b);
+        free(b);
+        return 1;
+    }
+
+    lockjobs(&mask_all, NULL);
+
+    addjob(&jobs, pid, cmd->bg ? BG : FG, cmd->text, cmd->len);
+    job = getjobpid(&jobs, pid);
+    job->batch = b;
+    jobs.nbatches++;
+    job->timed = cmd->timed;    /* reported when the batch ends */
+    cmd->timed = 0;
+    job->pinned = cmd->pinned;
+    job->cpus = cmd->cpus;
+    if (cmd->timeout > 0) {
+        tm_add(job, cmd->timeout, cmd->timeoutsig, cmd->grace);
+    }
+    reservepids(&jobs, job, b->max);    /* one spare, for batchahead */
+
+    /* Fill the batch; later instances are started by reapchild */
+    while (job->npids < b->max) {
+        if ((pid = startinst(b, job->pid, 0)) < 0) {
+            batchfail(job, errno);
+            break;
+        }
+        addmember(&jobs, job, pid);
+    }
+    if (b->next >= b->ninst) {
+        closestdio(b);
+    }
+
+    /* A batch is not watched through a pidfd, which would reap
+     * its leader without batchwait seeing it first
+     */
+    atomic_fggpid = cmd->bg ? 0 : job->pid;
+
+    if (cmd->bg) {
+        printf("[%d] (%d) %.*s\n", job->jid, job->pid, (int)cmd->len, cmd->text);
+    }
+
+    unlockjobs(&prev_one);
+
+    if (cmd->bg) {
+        return 0;
+    }
+    waitfg();
+    return laststatus;
+}
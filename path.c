@@ -0,0 +1,280 @@
+#include "header.h"
+#include <sys/stat.h>
+
+/*
+ * Command location cache
+ *
+ * Maps command names to the executable found by searching PATH,
+ *    so a launch only walks PATH the first time a name is used.
+ *    The table is open addressed with linear probing and grows
+ *    when it is three quarters full. Entries are dropped when
+ *    PATH changes, when an exec of a cached path fails with
+ *    ENOENT, or by `hash -r`.
+ *
+ * A lookup can also be remembered in a lookup_t, which the line
+ *    cache keeps with a parsed line, and taken from there again
+ *    without hashing the name or checking PATH. The table's
+ *    generation counts every change that could make such a
+ *    lookup stale, so one from another generation is not used.
+ */
+
+#define DEFPATH  "/bin:/usr/bin"    /* search path when PATH is unset */
+#define MINSLOTS 64                 /* initial size of the table      */
+
+struct pathent_t {                  /* A cached command location */
+  char *name;                       /* command name (owns path)  */
+  char *path;                       /* resolved executable       */
+  unsigned hits;                    /* lookups served            */
+};
+
+static struct pathent_t *table;     /* open addressed slots      */
+static size_t nslots;               /* size of table (power of 2)*/
+static size_t nused;                /* occupied slots            */
+static char *cachedpath;            /* PATH the cache was built on */
+static unsigned gen;                /* bumped when entries change  */
+
+/* pathhash - FNV-1a hash of a command name */
+static size_t pathhash(const char *name)
+{
+    size_t h = 2166136261u;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* findslot - Slot holding name, or the empty slot it belongs in */
+static struct pathent_t *findslot(const char *name)
+{
+    size_t i = pathhash(name) & (nslots - 1);
+
+    while (table[i].name && strcmp(table[i].name, name)) {
+        i = (i + 1) & (nslots - 1);
+    }
+    return &table[i];
+}
+
+/* growtable - Double the table and rehash every entry */
+static void growtable(void)
+{
+    struct pathent_t *old = table, *slot;
+    size_t i, oldslots = nslots;
+
+    nslots = oldslots ? oldslots * 2 : MINSLOTS;
+    if ((table = calloc(nslots, sizeof(*table))) == NULL) {
+        unix_error("growtable error");
+    }
+
+    for (i = 0; i < oldslots; i++) {
+        if (old[i].name) {
+            slot = findslot(old[i].name);
+            *slot = old[i];
+        }
+    }
+    free(old);
+    gen++;
+}
+
+/* pathclear - Forget every cached command location */
+void pathclear(void)
+{
+    size_t i;
+
+    for (i = 0; i < nslots; i++) {
+        free(table[i].name);
+        table[i].name = NULL;
+    }
+    nused = 0;
+    gen++;
+}
+
+/*
+ * pathforget - Drop the cached location of name. Entries are
+ *    reinserted after the removed slot so probe chains stay
+ *    unbroken.
+ */
+void pathforget(const char *name)
+{
+    struct pathent_t *slot, moved;
+    size_t i;
+
+    if (!nused || (slot = findslot(name))->name == NULL) {
+        return;
+    }
+
+    free(slot->name);
+    slot->name = NULL;
+    nused--;
+    gen++;
+
+    i = ((slot - table) + 1) & (nslots - 1);
+    while (table[i].name) {
+        moved = table[i];
+        table[i].name = NULL;
+        *findslot(moved.name) = moved;
+        i = (i + 1) & (nslots - 1);
+    }
+}
+
+/*
+ * checkpath - Invalidate the cache if PATH has changed since
+ *    it was filled
+ */
+static const char *checkpath(void)
+{
+    const char *path = getenv("PATH");
+
+    if (path == NULL) {
+        path = DEFPATH;
+    }
+    if (cachedpath == NULL || strcmp(cachedpath, path)) {
+        pathclear();
+        free(cachedpath);
+        if ((cachedpath = strdup(path)) == NULL) {
+            unix_error("checkpath error");
+        }
+    }
+    return path;
+}
+
+/* searchpath - Walk PATH for an executable regular file called name */
+static char *searchpath(const char *path, const char *name, char *buf, size_t size)
+{
+    const char *dir = path, *end;
+    size_t dirlen, namelen = strlen(name);
+    struct stat st;
+
+    while (TRUE) {
+        end = strchr(dir, ':');
+        dirlen = end ? (size_t)(end - dir) : strlen(dir);
+
+        /* An empty PATH entry names the current directory */
+        if (dirlen == 0) {
+            dir = ".";
+            dirlen = 1;
+        }
+        if (dirlen + namelen + 2 <= size) {
+            memcpy(buf, dir, dirlen);
+            buf[dirlen] = '/';
+            memcpy(buf + dirlen + 1, name, namelen + 1);
+
+            if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) &&
+                (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+                return buf;
+            }
+        }
+        if (end == NULL) {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+/*
+ * pathfind - Resolve a command name to an executable path.
+ *    Names containing a '/' are used as given. Returns NULL
+ *    when the command cannot be found on PATH. If lk is not
+ *    NULL, a name that is found is remembered in it.
+ */
+const char *pathfind(const char *name, struct lookup_t *lk)
+{
+    struct pathent_t *slot = NULL;
+    char buf[MAXLINE];
+    const char *path;
+    size_t namelen;
+
+    if (strchr(name, '/')) {
+        path = name;
+        goto found;
+    }
+
+    path = checkpath();
+
+    if (nused && (slot = findslot(name))->name) {
+        slot->hits++;
+        path = slot->path;
+        goto found;
+    }
+
+    if (searchpath(path, name, buf, sizeof(buf)) == NULL) {
+        return NULL;
+    }
+
+    if ((nused + 1) * 4 > nslots * 3) {
+        growtable();
+    }
+
+    /* The name and its path share one allocation */
+    namelen = strlen(name) + 1;
+    slot = findslot(name);
+    if ((slot->name = malloc(namelen + strlen(buf) + 1)) == NULL) {
+        unix_error("pathlookup error");
+    }
+    memcpy(slot->name, name, namelen);
+    path = slot->path = strcpy(slot->name + namelen, buf);
+    slot->hits = 1;
+    nused++;
+
+found:
+    if (lk) {
+        lk->name = name;
+        lk->path = path;
+        lk->slot = slot ? slot - table : -1;
+        lk->gen = gen;
+    }
+    return path;
+}
+
+/* pathlookup - Resolve a command name, as pathfind does */
+const char *pathlookup(const char *name)
+{
+    return pathfind(name, NULL);
+}
+
+/*
+ * pathsearch - Resolve name on the search path given, not PATH,
+ *    into buf, as for a command run with PATH=... of its own.
+ *    The cache is neither used nor filled.
+ */
+const char *pathsearch(const char *path, const char *name, char *buf, size_t size)
+{
+    if (strchr(name, '/')) {
+        return name;
+    }
+    return searchpath(path, name, buf, size);
+}
+
+/*
+ * pathreuse - The path remembered in lk, counted as a hit, or
+ *    NULL if there is none or the table has changed since
+ */
+const char *pathreuse(const struct lookup_t *lk)
+{
+    if (lk->path == NULL || lk->gen != gen) {
+        return NULL;
+    }
+    if (lk->slot >= 0) {
+        table[lk->slot].hits++;
+    }
+    return lk->path;
+}
+
+/* listpaths - Print the cached command locations */
+void listpaths(void)
+{
+    size_t i;
+
+    if (!nused) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for (i = 0; i < nslots; i++) {
+        if (table[i].name) {
+            printf("%4u\t%s\n", table[i].hits, table[i].path);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include "header.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Command input
+ *
+ * The shell reads its commands through a reader, which hands
+ *    out one line at a time as a pointer into its own buffer and
+ *    a length, so no line is ever copied on its way to eval and
+ *    there is no limit on its length. A script that is a regular
+ *    file is mapped whole; a pipe or a terminal is read in blocks
+ *    of RDBLOCK bytes into a buffer that grows to hold the
+ *    longest line seen; `mpsh -c` reads from its argument.
+ */
+
+#define RDBLOCK (1<<16)             /* bytes asked for per read */
+
+/* rd_fd - Read commands from descriptor fd */
+void rd_fd(struct reader_t *rd, int fd)
+{
+    rd->fd = fd;
+    rd->buf = NULL;
+    rd->size = 0;
+    rd->start = 0;
+    rd->len = 0;
+    rd->scanned = 0;
+    rd->eof = 0;
+}
+
+/* rd_string - Read commands from the len bytes at s */
+void rd_string(struct reader_t *rd, const char *s, size_t len)
+{
+    rd_fd(rd, -1);
+    rd->buf = (char *)s;
+    rd->len = len;
+    rd->eof = 1;
+}
+
+/*
+ * rd_file - Read commands from the script at path. A regular
+ *    file is mapped rather than read; anything else is opened
+ *    close-on-exec and read like stdin.
+ */
+void rd_file(struct reader_t *rd, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+        unix_error((char *)path);
+    }
+    rd_fd(rd, fd);
+
+    if (!S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    if (st.st_size > 0) {
+        rd->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (rd->buf == MAP_FAILED) {
+            unix_error("mmap error");
+        }
+        madvise(rd->buf, st.st_size, MADV_SEQUENTIAL);
+        rd->size = rd->len = st.st_size;
+    }
+    rd->eof = 1;
+    rd->fd = -1;
+    close(fd);
+}
+
+/*
+ * rd_fill - Read one block of input into the buffer, making
+ *    room first by moving the unread bytes to the front or
+ *    growing the buffer. Returns the number of bytes read, 0 at
+ *    end of file, or -1 if the read was interrupted.
+ */
+ssize_t rd_fill(struct reader_t *rd)
+{
+    size_t size;
+    ssize_t n;
+    char *buf;
+
+    if (rd->eof) {
+        return 0;
+    }
+
+    if (rd->start + rd->len + RDBLOCK > rd->size) {
+        if (rd->start > 0) {
+            memmove(rd->buf, rd->buf + rd->start, rd->len);
+            rd->start = 0;
+        }
+        for (size = rd->size ? rd->size : RDBLOCK; rd->len + RDBLOCK > size; ) {
+            size *= 2;
+        }
+        if (size > rd->size) {
+            if ((buf = realloc(rd->buf, size)) == NULL) {
+                unix_error("rd_fill error");
+            }
+            rd->buf = buf;
+            rd->size = size;
+        }
+    }
+
+    n = read(rd->fd, rd->buf + rd->start + rd->len, RDBLOCK);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return -1;
+        }
+        app_error("read error");
+    }
+    if (n == 0) {
+        rd->eof = 1;
+    }
+    rd->len += n;
+    return n;
+}
+
+/* findnl - The newline ending the next line, if it has been read */
+static char *findnl(struct reader_t *rd)
+{
+    char *nl;
+
+    if (rd->scanned == rd->len) {
+        return NULL;
+    }
+
+    /* Bytes already searched are not searched again */
+    nl = memchr(rd->buf + rd->start + rd->scanned, '\n', rd->len - rd->scanned);
+    if (nl == NULL) {
+        rd->scanned = rd->len;
+    }
+    return nl;
+}
+
+/* rd_ready - Can rd_line return without reading? */
+int rd_ready(struct reader_t *rd)
+{
+    return rd->eof || findnl(rd) != NULL;
+}
+
+/*
+ * rd_line - Return the next line, without its newline, and set
+ *    *len to its length. The line stays valid until the next
+ *    call. Returns NULL at end of input.
+ */
+char *rd_line(struct reader_t *rd, size_t *len)
+{
+    char *line, *nl;
+
+    while ((nl = findnl(rd)) == NULL && !rd->eof) {
+        rd_fill(rd);
+    }
+    if (nl == NULL && rd->len == 0) {
+        return NULL;
+    }
+
+    line = rd->buf + rd->start;
+    *len = nl ? (size_t)(nl - line) : rd->len;
+
+    /* A final line without a newline is taken as it is */
+    rd->start += *len + (nl != NULL);
+    rd->len -= *len + (nl != NULL);
+    rd->scanned = 0;
+    return line;
+}
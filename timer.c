@@ -0,0 +1,222 @@
+#include "header.h"
+
+/*
+ * Job timeouts (timeout DURATION cmd)
+ *
+ * A timed job runs as an ordinary job. Its deadline goes into a
+ *    min-heap, and one POSIX timer on CLOCK_MONOTONIC is kept
+ *    armed for the earliest deadline, so any number of timed
+ *    jobs costs one timer and no helper processes. The timer
+ *    raises SIGALRM: sigalrm_handler, or the event loop's
+ *    signalfd, then signals the process group of each job whose
+ *    deadline has passed and, after the grace period given with
+ *    -k, kills it.
+ *
+ * A job that ends before its deadline leaves its entry in the
+ *    heap; each job gets a timer ID of its own, so the entry is
+ *    recognised and dropped when it comes due, even if the JID
+ *    has been reused since.
+ *
+ * The heap is changed with every signal blocked (by the caller,
+ *    or as a handler), and only tm_add allocates.
+ */
+
+struct tmentry_t {              /* A pending deadline             */
+  struct timespec when;         /* CLOCK_MONOTONIC                */
+  jid_t jid;                    /* job it is for                  */
+  unsigned id;                  /* the job's timerid              */
+  int sig;                      /* signal to send                 */
+  double grace;                 /* then SIGKILL this much later   */
+};
+
+static struct tmentry_t *heap;
+static int nheap, heapcap;
+static timer_t timer;
+static int havetimer;           /* timer has been created         */
+static unsigned nextid;         /* last timer ID handed out       */
+
+static const struct { const char *name; int sig; } signames[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+    { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 },
+    { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+};
+
+/*
+ * parseduration - Parse a time such as 1.5, 30s, 2m, 1h or 1d
+ *    into seconds. Returns -1 if s is not one.
+ */
+int parseduration(const char *s, double *secs)
+{
+    char *end;
+    double n = strtod(s, &end);
+
+    if (end == s || n < 0 || (*end && (end[1] || !strchr("smhd", *end)))) {
+        return -1;
+    }
+    *secs = n * (*end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 1);
+    return 0;
+}
+
+/* parsesignal - Signal named by s (TERM, SIGTERM or 15), or -1 */
+int parsesignal(const char *s)
+{
+    char *end;
+    int i, sig;
+
+    if (isdigit((unsigned char)*s)) {
+        sig = strtol(s, &end, 10);
+        return *end || sig < 1 || sig >= NSIG ? -1 : sig;
+    }
+    if (!strncmp(s, "SIG", 3)) {
+        s += 3;
+    }
+    for (i = 0; i < sizeof(signames) / sizeof(*signames); i++) {
+        if (!strcmp(s, signames[i].name)) {
+            return signames[i].sig;
+        }
+    }
+    return -1;
+}
+
+/* tsadd - t plus secs */
+static struct timespec tsadd(struct timespec t, double secs)
+{
+    t.tv_sec += (time_t)secs;
+    t.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+    }
+    return t;
+}
+
+/* tsbefore - Is a earlier than b? */
+static int tsbefore(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* push - Add e to the heap, which has room for it */
+static void push(const struct tmentry_t *e)
+{
+    int i = nheap++, parent;
+
+    while (i > 0 && tsbefore(&e->when, &heap[parent = (i - 1) / 2].when)) {
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = *e;
+}
+
+/* pop - Remove the earliest entry from the heap into *e */
+static void pop(struct tmentry_t *e)
+{
+    struct tmentry_t last = heap[--nheap];
+    int i = 0, child;
+
+    *e = heap[0];
+    while ((child = 2 * i + 1) < nheap) {
+        if (child + 1 < nheap && tsbefore(&heap[child+1].when, &heap[child].when)) {
+            child++;
+        }
+        if (!tsbefore(&heap[child].when, &last.when)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+/* rearm - Set the timer for the earliest deadline, or stop it */
+static void rearm(void)
+{
+    struct itimerspec its;
+
+    if (!havetimer) {
+        return;                 /* a stray SIGALRM */
+    }
+    memset(&its, 0, sizeof(its));
+    if (nheap > 0) {
+        its.it_value = heap[0].when;
+    }
+    timer_settime(timer, TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * tm_add - Give job a deadline secs from now, when sig is sent
+ *    to it, followed by SIGKILL grace seconds later (if grace is
+ *    not 0). Called with every signal blocked.
+ */
+void tm_add(struct job_t *job, double secs, int sig, double grace)
+{
+    struct sigevent sev;
+    struct tmentry_t e, *h;
+    struct timespec now;
+
+    if (!havetimer) {
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGALRM;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &timer) < 0) {
+            unix_error("timer_create error");
+        }
+        havetimer = 1;
+    }
+    if (nheap == heapcap) {
+        heapcap = heapcap ? heapcap * 2 : 64;
+        if ((h = realloc(heap, heapcap * sizeof(*heap))) == NULL) {
+            unix_error("timeout error");
+        }
+        heap = h;
+    }
+
+    if (++nextid == 0) {
+        nextid = 1;
+    }
+    job->timerid = nextid;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    e.when = tsadd(now, secs);
+    e.jid = job->jid;
+    e.id = job->timerid;
+    e.sig = sig;
+    e.grace = grace;
+    push(&e);
+    rearm();
+}
+
+/*
+ * tm_expire - Signal every job whose deadline has passed. Called
+ *    on SIGALRM, with every signal blocked. Async-signal-safe.
+ */
+void tm_expire(void)
+{
+    struct tmentry_t e;
+    struct timespec now;
+    struct job_t *job;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (nheap > 0 && !tsbefore(&now, &heap[0].when)) {
+        pop(&e);
+        job = getjobjid(&jobs, e.jid);
+        if (job == NULL || job->timerid != e.id) {
+            continue;           /* ended in time */
+        }
+
+        kill(-job->pid, e.sig);
+        if (job->state == ST) {
+            kill(-job->pid, SIGCONT);
+        }
+        job->timedout = 1;
+
+        /* Reuses the slot just popped, so never allocates */
+        if (e.grace > 0 && e.sig != SIGKILL) {
+            e.when = tsadd(now, e.grace);
+            e.sig = SIGKILL;
+            push(&e);
+        }
+    }
+    rearm();
+}
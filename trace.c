@@ -0,0 +1,151 @@
+#include "header.h"
+
+/*
+ * Event trace (mpsh -l, or `trace on`)
+ *
+ * Checkpoints on the launch and reap paths record fixed-size
+ *    binary events into a ring in memory instead of writing a
+ *    line each, so tracing barely changes the timing of the
+ *    races it is used to look at. A record costs one atomic
+ *    increment to claim a slot and a clock_gettime, which is
+ *    served from the vDSO without entering the kernel; when
+ *    tracing is off the Trace macro skips the call altogether.
+ *
+ * A signal handler may record an event while the code it
+ *    interrupted is halfway through its own. Each claims a
+ *    different slot, and a slot's sequence number is stored
+ *    last, so the decoder can tell a finished record from one
+ *    that was cut short or has since been overwritten. Only
+ *    the newest TRACESIZE events are kept.
+ */
+
+#define TRACESIZE 8192              /* events kept (power of 2) */
+
+struct tracerec_t {                 /* A recorded event          */
+  uint64_t ns;                      /* CLOCK_MONOTONIC, in ns    */
+  uint32_t seq;                     /* slot claim + 1, 0 if torn */
+  uint8_t ev;                       /* TR_EVAL, TR_REAP, ...     */
+  uint8_t step;                     /* checkpoint within event   */
+  int32_t pid;                      /* process involved, or 0    */
+  int32_t jid;                      /* job involved, or 0        */
+};
+
+volatile sig_atomic_t tracing = 0;  /* if true, record events    */
+
+static struct tracerec_t ring[TRACESIZE];
+static uint32_t head;               /* next slot to claim        */
+static uint64_t epoch;              /* time tracing was started  */
+
+static const char *evnames[] = {
+    "EVAL", "LAUNCH", "REAP", "TERM", "STOP", "WAITFG", "EVWAIT"
+};
+
+/* now_ns - Monotonic clock in nanoseconds */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * trace_event - Record an event. Async-signal-safe; called
+ *    through the Trace macro, so only while tracing is on.
+ */
+void trace_event(int ev, int step, pid_t pid, jid_t jid)
+{
+    uint32_t seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct tracerec_t *r = &ring[seq & (TRACESIZE - 1)];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    r->ns = now_ns();
+    r->ev = ev;
+    r->step = step;
+    r->pid = pid;
+    r->jid = jid;
+    __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* trace_start - Start recording events */
+void trace_start(void)
+{
+    if (!tracing) {
+        epoch = now_ns();
+        tracing = 1;
+    }
+}
+
+/* trace_stop - Stop recording events, keeping those recorded */
+void trace_stop(void)
+{
+    tracing = 0;
+}
+
+/* trace_clear - Forget every recorded event */
+void trace_clear(void)
+{
+    memset(ring, 0, sizeof(ring));
+    head = 0;
+    epoch = now_ns();
+}
+
+/*
+ * trace_dump - Decode the ring to stdout, oldest event first,
+ *    with times relative to when tracing was started
+ */
+void trace_dump(void)
+{
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t seq = end > TRACESIZE ? end - TRACESIZE : 0;
+    struct tracerec_t r;
+    uint64_t us;
+
+    if (seq > 0) {
+        printf("trace: %u older events overwritten\n", seq);
+    }
+    for (; seq != end; seq++) {
+        r = ring[seq & (TRACESIZE - 1)];
+        if (r.seq != seq + 1 || r.ev >= sizeof(evnames) / sizeof(*evnames)) {
+            continue;           /* cut short by a signal */
+        }
+        us = r.ns > epoch ? (r.ns - epoch) / 1000 : 0;
+        printf("%6lu.%06lu %-6s [%d] pid %d jid %d\n",
+            (unsigned long)(us / 1000000), (unsigned long)(us % 1000000),
+            evnames[r.ev], r.step, r.pid, r.jid);
+    }
+    fflush(stdout);
+}
+
+/*
+ * do_trace - Execute the builtin trace command
+ *
+ *    trace          print the recorded events
+ *    trace on|off   start or stop recording
+ *    trace clear    forget the recorded events
+ */
+int do_trace(char **argv)
+{
+    if (argv[1] == NULL) {
+        trace_dump();
+    }
+    else if (argv[2] != NULL) {
+        printf("trace: Invalid option %s\n", argv[2]);
+        return 1;
+    }
+    else if (!strcmp(argv[1], "on")) {
+        trace_start();
+    }
+    else if (!strcmp(argv[1], "off")) {
+        trace_stop();
+    }
+    else if (!strcmp(argv[1], "clear")) {
+        trace_clear();
+    }
+    else {
+        printf("trace: Invalid option %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -1,8 +1,11 @@
 #include "header.h"
+#include <poll.h>
 
-extern volatile int logger;
-extern char *environ[];
 extern volatile sig_atomic_t atomic_fggpid;
+extern volatile sig_atomic_t atomic_intr;
+extern char evloop;
+
+int laststatus = 0;     /* status of the last foreground command */
 
 /*
  * unix_error - unix-style error routine
@@ -23,20 +26,213 @@ void app_error(char *msg)
 }
 
 /*
- * Log - emits I/O safe logs whether global
- *      macro LOG is on or off
+ * stripwords - Take the first n words off cmd. Stage argv
+ *    offsets count from cmd->argv, so the later stages move
+ *    back n words.
+ */
+static void stripwords(struct cmdline_t *cmd, int n)
+{
+    int i;
+
+    cmd->argv += n;
+    for (i = 1; i < cmd->nstages; i++) {
+        cmd->stage[i].argv -= n;
+    }
+}
+
+/*
+ * striptime - Take a leading `time` off cmd, recording that the
+ *    job it runs is to be timed
+ */
+static void striptime(struct cmdline_t *cmd)
+{
+    if (cmd->argv[0] != NULL && !strcmp(cmd->argv[0], "time")) {
+        cmd->timed = 1;
+        stripwords(cmd, 1);
+    }
+}
+
+/*
+ * stripcpu - Take a leading `cpu LIST` off cmd, placing the job
+ *    on those CPUs. Returns 1 if it did, 0 if cmd does not start
+ *    that way, or -1, after printing an error, if the shell
+ *    cannot run anything there.
+ */
+static int stripcpu(struct cmdline_t *cmd)
+{
+    if (cmd->argv[0] == NULL || strcmp(cmd->argv[0], "cpu") ||
+        cmd->argv[1] == NULL || cmd->argv[2] == NULL ||
+        cpu_parse(cmd->argv[1], &cmd->cpus) < 0) {
+        return 0;
+    }
+    if (cpu_check(cmd->argv[1], &cmd->cpus) < 0) {
+        return -1;
+    }
+    cmd->pinned = 1;
+    stripwords(cmd, 2);
+    return 1;
+}
+
+/*
+ * striplimits - Take a leading `ulimit -x n ...` that is followed
+ *    by a command off cmd, keeping the limits for the job. Returns
+ *    1 if it did, 0 if cmd is not such a command (and the ulimit
+ *    builtin will run), or -1 after printing an error.
+ */
+static int striplimits(struct cmdline_t *cmd)
+{
+    int n, show;
+
+    if (cmd->argv[0] == NULL || strcmp(cmd->argv[0], "ulimit")) {
+        return 0;
+    }
+    if ((n = lim_parse(cmd->argv, cmd->limits, &cmd->nlimits, &show)) < 0) {
+        return -1;
+    }
+    if (cmd->argv[n] == NULL || cmd->nlimits == 0 || show) {
+        cmd->nlimits = 0;
+        return 0;
+    }
+    stripwords(cmd, n);
+    return 1;
+}
+
+/*
+ * striptimeout - Take a leading `timeout [-s SIG] [-k GRACE]
+ *    DURATION` off cmd, giving the job a deadline. Returns 1 if
+ *    it did, 0 if cmd does not start with timeout, or -1 after
+ *    printing an error.
  */
-void Log(char *msg, int len)
+static int striptimeout(struct cmdline_t *cmd)
 {
-    sio_puts(msg, len & logger);
+    char **argv = cmd->argv;
+    int i;
+
+    if (argv[0] == NULL || strcmp(argv[0], "timeout")) {
+        return 0;
+    }
+    cmd->timeoutsig = SIGTERM;
+    cmd->grace = 0;
+    for (i = 1; argv[i] && argv[i+1] && argv[i][0] == '-'; i += 2) {
+        if (!strcmp(argv[i], "-s")) {
+            if ((cmd->timeoutsig = parsesignal(argv[i+1])) < 0) {
+                printf("timeout: %s: invalid signal\n", argv[i+1]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-k") || parseduration(argv[i+1], &cmd->grace) < 0) {
+            break;
+        }
+    }
+    if (argv[i] == NULL || argv[i+1] == NULL) {
+        printf("timeout: usage: timeout [-s signal] [-k duration] duration command\n");
+        return -1;
+    }
+    if (parseduration(argv[i], &cmd->timeout) < 0) {
+        printf("timeout: %s: invalid time interval\n", argv[i]);
+        return -1;
+    }
+    stripwords(cmd, i + 1);
+    return 1;
+}
+
+/*
+ * stripassigns - Take the NAME=value words off the front of each
+ *    stage of cmd, keeping them as the stage's assignments. A
+ *    line that is nothing but assignments keeps them too, and is
+ *    left with no command; in a pipeline such a stage is left
+ *    alone to fail as a command. A stage keeps only its first
+ *    run of assignments.
+ */
+static void stripassigns(struct cmdline_t *cmd)
+{
+    struct stage_t *stage;
+    char **argv;
+    int i, n;
+
+    for (i = 0; i < cmd->nstages; i++) {
+        stage = &cmd->stage[i];
+        argv = &cmd->argv[stage->argv];
+        for (n = 0; argv[n] && env_isassign(argv[n]); n++)
+            ;
+        if (n == 0 || stage->nassigns > 0 ||
+            (argv[n] == NULL && cmd->nstages > 1)) {
+            continue;
+        }
+        stage->assigns = argv;
+        stage->nassigns = n;
+        if (i == 0) {
+            stripwords(cmd, n);
+        }
+        else {
+            stage->argv += n;
+        }
+    }
+}
+
+/*
+ * stripprefixes - Take the words that set up how a job runs off
+ *    the front of cmd: NAME=value assignments, `time`, `cpu
+ *    LIST`, `ulimit ...` and `timeout ...`, in any order, so
+ *    `time A=1 cmd` works as well as `A=1 time cmd`. Returns -1,
+ *    after printing an error, if one of them is wrong.
+ */
+static int stripprefixes(struct cmdline_t *cmd)
+{
+    char **argv;
+    int done;
+
+    do {
+        argv = cmd->argv;
+        stripassigns(cmd);
+        striptime(cmd);
+        if ((done = stripcpu(cmd)) == 0 &&
+            (done = striplimits(cmd)) == 0) {
+            done = striptimeout(cmd);
+        }
+        if (done < 0) {
+            return -1;
+        }
+    } while (cmd->argv != argv);
+    return 0;
+}
+
+/*
+ * timebuiltin - Run a timed builtin. It runs in the shell, so
+ *    its cost is the change in the shell's own usage. A builtin
+ *    that starts a job (parallel) hands the timing to the job.
+ */
+static void timebuiltin(struct cmdline_t *cmd)
+{
+    struct rusage before, after, ru;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &before);
+
+    runbuiltin(cmd);
+    if (!cmd->timed) {
+        return;
+    }
+
+    getrusage(RUSAGE_SELF, &after);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    timersub(&after.ru_utime, &before.ru_utime, &ru.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &ru.ru_stime);
+    ru.ru_maxrss = after.ru_maxrss;
+    ru.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    ru.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    printtime(&start, &end, &ru);
 }
 
 /*
  * eval - Evaluate the command line that the user has
- *    just typed in
+ *    just typed in: len bytes at cmdline, without the newline,
+ *    already history expanded by fl_eval
  *
  * If the user has requested a built-in command (quit, jobs,
- *    bg or fg) then execute it immediately. Otherwise, fork a
+ *    bg or fg) then execute it immediately. Otherwise, launch a
  *    child process and run the job in the context of the child.
  *    If the job is running in the foreground, wait for it to
  *    terminate and then return.
@@ -46,66 +242,117 @@ void Log(char *msg, int len)
  *    SIGINT (SIGSTP) from the kernel
  *    when we type ctrl-c (ctrl-z) at the keyboard.
  */
-void eval(char *cmdline)
+void eval(const char *cmdline, size_t len)
 {
-    char *argv[MAXARGS], buf[MAXLINE];
-    int bg, status, state;
+    struct cmdline_t cmd;
+
+    Trace(TR_EVAL, 0, 0, 0);
+
+    if (lc_parse(cmdline, len, &cmd) < 0) {
+        laststatus = 2;
+        return;
+    }
+    evalcmd(&cmd);
+}
+
+/*
+ * evalcmd - Run cmd, a line as parsed, with its own copy of the
+ *    stages: expand it, take its prefixes off and run it as a
+ *    builtin or a job, in the background if it ends in '&'
+ */
+void evalcmd(struct cmdline_t *cmd)
+{
+    int bg = cmd->bg, status, state, i;
     volatile pid_t pid;
     int jid;
+    struct job_t *job;
     sigset_t mask_all, mask_one, prev_one;
+    struct timespec now;
+    struct rusage ru;
 
-    Log("EVAL [0]\n", 9);
-
-    strcpy(buf, cmdline);
-    bg = parseline(buf, argv);
-
-    if (argv[0] == NULL) {
+    ex_expand(cmd);
+    gl_expand(cmd);
+    if (stripprefixes(cmd) < 0) {
+        laststatus = 1;
+        return;
+    }
+    if (cmd->argv[0] == NULL) {
+        /* NAME=value on its own sets a shell variable */
+        for (i = 0; i < cmd->stage[0].nassigns; i++) {
+            env_assign(cmd->stage[0].assigns[i], 0);
+            laststatus = 0;
+        }
+        if (cmd->timed) {
+            memset(&ru, 0, sizeof(ru));
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            printtime(&now, &now, &ru);
+        }
         return;
     }
 
-    Log("EVAL [1]\n", 9);
+    Trace(TR_EVAL, 1, 0, 0);
 
-    if (builtin_cmd(argv)) {
+    if (cmd->nstages == 1 && isbuiltin(cmd)) {
+        if (cmd->timed) {
+            timebuiltin(cmd);
+        }
+        else {
+            runbuiltin(cmd);
+        }
         return;
     }
 
-    Log("EVAL [2]\n", 9);
+    Trace(TR_EVAL, 2, 0, 0);
 
     Sigfillset(&mask_all);
     Sigemptyset(&mask_one);
     Sigaddset(&mask_one, SIGCHLD);
 
-    Sigprocmask(SIG_BLOCK, &mask_one, &prev_one);
-
-    pid = Fork();
+    lockjobs(&mask_one, &prev_one);
 
-    if (pid == CHILD) {
-        Sigprocmask(SIG_SETMASK, &prev_one, NULL);
-        Setpgid(0, 0);
-        Log("EVAL [3]\n", 9);
-        Execve(argv[0], argv, environ);
+    cpu_place(cmd);
+    if (launchpipe(cmd, &prev_one) < 0) {
+        unlockjobs(&prev_one);
+        return;
     }
+    pid = cmd->stage[0].pid;
 
-    Sigprocmask(SIG_BLOCK, &mask_all, NULL);
+    lockjobs(&mask_all, NULL);
 
     state = bg ? BG : FG;
 
-    Log("EVAL [4]\n", 9);
-
-    status = addjob(jobs, pid, state, cmdline);
+    Trace(TR_EVAL, 3, pid, 0);
 
-    Log("EVAL [5]\n", 9);
+    status = addjob(&jobs, pid, state, cmd->text, cmd->len);
 
     /* Stores jid while process has not been removed */
-    jid = getjobpid(jobs, pid)->jid;
+    job = getjobpid(&jobs, pid);
+    jid = job->jid;
+    job->timed = cmd->timed;
+    job->pinned = cmd->pinned;
+    job->cpus = cmd->cpus;
+    if (cmd->timeout > 0) {
+        tm_add(job, cmd->timeout, cmd->timeoutsig, cmd->grace);
+    }
+
+    Trace(TR_EVAL, 4, pid, jid);
+
+    /* The remaining stages belong to the same job */
+    for (i = 1; i < cmd->nstages; i++) {
+        addmember(&jobs, job, cmd->stage[i].pid);
+    }
+
+    if (evloop) {
+        ev_watch(job);
+    }
 
     atomic_fggpid = bg ? 0 : pid;
 
-    Log("EVAL [5a]\n", 10);
+    Trace(TR_EVAL, 5, pid, jid);
 
-    Sigprocmask(SIG_SETMASK, &prev_one, NULL);
+    unlockjobs(&prev_one);
 
-    Log("EVAL [5b]\n", 10);
+    Trace(TR_EVAL, 6, pid, jid);
 
     /* Handle errors when generating a new job */
     if (!status) {
@@ -114,142 +361,390 @@ void eval(char *cmdline)
 
     /* Parent waits for foreground job to terminate */
     if (!bg) {
-        Log("EVAL [6]\n", 9);
-        waitfg(pid);
+        Trace(TR_EVAL, 7, pid, jid);
+        waitfg();
     }
     else {
-        Log("EVAL [7]\n", 9);
-        printf("[%d] (%d) %s", jid, pid, cmdline);
+        Trace(TR_EVAL, 8, pid, jid);
+        laststatus = 0;
+        printf("[%d] (%d) %.*s\n", jid, pid, (int)cmd->len, cmd->text);
     }
 }
 
+#define WORDDELIM " \t\n|"       /* characters that end a word */
+
+/* isdelim - Does the word being scanned end at p? */
+static int isdelim(const char *p, const char *end)
+{
+    return p == end || *p == '\0' || strchr(WORDDELIM, *p);
+}
+
 /*
- * parseline - Parse the command line and build the argv
- *    array.
- *
- * Characters enclosed in single quotes are treated as a
- *    single argument. Return true if the user has requested
- *    a BG job, false if the user has requested a
- *    FG job.
+ * getword - Copy the word at buf to *out, NUL terminated, point
+ *    *slot at it and return the position just after it. A word
+ *    in single quotes may hold any character but a quote; any
+ *    other word ends at a space or a '|', and is compiled into
+ *    one of cmd's templates if it holds a $.
+ */
+static const char *getword(const char *buf, const char *end, char **out,
+                           struct cmdline_t *cmd, char **slot)
+{
+    const char *p;
+    int quoted = *buf == '\'';
+
+    if (quoted) {
+        buf++;
+        if ((p = memchr(buf, '\'', end - buf)) == NULL) {
+            p = end;
+        }
+    }
+    else {
+        for (p = buf; !isdelim(p, end); p++)
+            ;
+    }
+
+    *slot = *out;
+    memcpy(*out, buf, p - buf);
+    (*out)[p - buf] = '\0';
+    *out += p - buf + 1;
+    if (!quoted && memchr(buf, '$', p - buf)) {
+        ex_compile(cmd, slot);
+    }
+    return p < end && *p == '\'' ? p + 1 : p;
+}
+
+/*
+ * getredir - Parse the redirection operator at buf (the part
+ *    after an optional descriptor number fd, -1 if none) and its
+ *    target into r. Returns the position after the target, or
+ *    NULL after reporting a syntax error.
  */
-int parseline(const char *cmdline, char **argv)
+static const char *getredir(const char *buf, const char *end, int fd,
+                            struct redir_t *r, char **out,
+                            struct cmdline_t *cmd)
 {
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line  */
-    char *delim;                /* points to first space delimiter  */
-    int argc;
-    int bg;
+    char op = *buf++;
 
-    strcpy(buf, cmdline);
-    buf[strlen(buf)-1] = ' ';   /* replace trailing '\n' with space */
+    r->fd = fd >= 0 ? fd : (op == '<' ? STDIN_FILENO : STDOUT_FILENO);
+    r->path = NULL;
 
-    /* ignore leading spaces */
-    while (*buf && (*buf == ' ')) {
+    if (op == '<') {
+        r->flags = O_RDONLY;
+    }
+    else if (buf < end && *buf == '>') {
+        r->flags = O_WRONLY | O_CREAT | O_APPEND;
         buf++;
     }
+    else {
+        r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+    }
 
-    /* Build the argv list */
-    argc = 0;
-    if (*buf == '\'') {
+    /* n>&m makes n a copy of descriptor m */
+    if (buf < end && *buf == '&') {
+        if (end - buf > 1 && isdigit((unsigned char)buf[1]) && isdelim(buf + 2, end)) {
+            r->from = buf[1] - '0';
+            return buf + 2;
+        }
+        printf("syntax error near '%c&'\n", op);
+        return NULL;
+    }
+
+    while (buf < end && (*buf == ' ' || *buf == '\t')) {
         buf++;
-        delim = strchr(buf, '\'');
+    }
+    if (buf == end || strchr("\n|<>&", *buf)) {
+        printf("syntax error near '%c'\n", op);
+        return NULL;
+    }
+
+    return getword(buf, end, out, cmd, &r->path);
+}
+
+/*
+ * reserve - Size arena for the len-byte line at cmdline and lay
+ *    out cmd's arrays in it. Every word, stage, redirection and
+ *    parameter starts at a character counted here, so the
+ *    counts are upper bounds, and the words take no more room
+ *    than the line plus a NUL each. Each $ adds at most three
+ *    template pieces: text before it, itself and text after it.
+ *    gl_expand keeps two ints per word, and one more, after the
+ *    pattern words. An arena that is kept gets a block of just
+ *    the size needed, and a copy of the line.
+ */
+static void reserve(const char *cmdline, size_t len, struct cmdline_t *cmd,
+                    struct arena_t *arena, int keep)
+{
+    size_t nwords = 1, nstages = 1, nredirs = 0, nparams = 0, i, size;
+    char *text;
+
+    for (i = 0; i < len; i++) {
+        switch (cmdline[i]) {
+            case ' ': case '\t': case '\n': case '\'':
+                nwords++;
+                break;
+            case '|':
+                nwords++;
+                nstages++;
+                break;
+            case '<': case '>':
+                nredirs++;
+                break;
+            case '$':
+                nparams++;
+                break;
+        }
+    }
+
+    size = (nwords + nstages) * sizeof(char *) +
+           nstages * sizeof(struct stage_t) +
+           nstages * sizeof(struct lookup_t) +
+           nredirs * sizeof(struct redir_t) +
+           nparams * sizeof(struct tmpl_t) +
+           3 * nparams * sizeof(struct seg_t) +
+           (2 * nwords + 1) * sizeof(int) +
+           len + nwords + 8 * ARENALIGN;
+    if (keep) {
+        arena_init(arena, size + len + ARENALIGN);
+        text = arena_alloc(arena, len);
+        memcpy(text, cmdline, len);
+        cmd->text = text;
     }
     else {
-        delim = strchr(buf, ' ');
+        arena_reset(arena, size);
+        cmd->text = cmdline;
     }
 
-    while (delim) {
-        argv[argc++] = buf;
-        *delim = '\0';
-        buf = delim + 1;
+    cmd->argv = arena_alloc(arena, (nwords + nstages) * sizeof(char *));
+    cmd->stage = arena_alloc(arena, nstages * sizeof(struct stage_t));
+    cmd->lookup = arena_alloc(arena, nstages * sizeof(struct lookup_t));
+    cmd->redir = arena_alloc(arena, nredirs * sizeof(struct redir_t));
+    cmd->tmpl = arena_alloc(arena, nparams * sizeof(struct tmpl_t));
+    cmd->seg = arena_alloc(arena, 3 * nparams * sizeof(struct seg_t));
+    cmd->globs = arena_alloc(arena, (2 * nwords + 1) * sizeof(int));
+    cmd->words = cmd->argv[0] = arena_alloc(arena, len + nwords);
+    cmd->wordsize = len + nwords;
+    memset(cmd->lookup, 0, nstages * sizeof(struct lookup_t));
+}
+
+/*
+ * parsein - Parse the len bytes of command line at cmdline
+ *    and build the argv array, in arena.
+ *
+ * Characters enclosed in single quotes are treated as a
+ *    single argument. A '|' outside quotes ends a pipeline
+ *    stage, and [n]<file, [n]>file, [n]>>file and [n]>&m
+ *    redirect a descriptor of the stage they appear in. An
+ *    operator is only recognized at the start of a word, so
+ *    "tsh>" is an ordinary argument. The words are copied out
+ *    of cmdline, which is left unchanged, into arena, along
+ *    with the line itself if keep is set. Words outside quotes
+ *    that hold a $ are also compiled into templates, for
+ *    ex_expand to fill in, and those that hold a pattern are
+ *    noted for gl_expand. Return true if the user has requested
+ *    a BG job, false if the user has requested a FG job, and -1
+ *    after reporting a syntax error.
+ */
+int parsein(const char *cmdline, size_t len, struct cmdline_t *cmd,
+            struct arena_t *arena, int keep)
+{
+    const char *buf;              /* ptr that traverses cmdline   */
+    const char *end;
+    char *out;                    /* where the next word goes     */
+    char **argv;
+    struct stage_t *stage;
+    int argc, bg, fd, quoted;
+
+    reserve(cmdline, len, cmd, arena, keep);
+    buf = cmd->text;
+    end = buf + len;
+    cmd->len = len;
+    cmd->bg = 0;
+    cmd->timed = 0;
+    cmd->pinned = 0;
+    cmd->nlimits = 0;
+    cmd->timeout = 0;
+    cmd->ntmpls = 0;
+    cmd->nsegs = 0;
+    cmd->nglobs = 0;
+    argv = cmd->argv;
+    out = argv[0];
+
+    /* Build the argv list */
+    argc = 0;
+    cmd->nstages = 1;
+    cmd->nredirs = 0;
+    stage = &cmd->stage[0];
+    stage->argv = 0;
+    stage->redir = 0;
+    stage->nassigns = 0;
+
+    while (buf < end) {
 
         /* ignore spaces */
-        while (*buf && (*buf == ' ')) {
+        if (*buf == ' ' || *buf == '\t' || *buf == '\n') {
             buf++;
+            continue;
         }
 
-        if (*buf == '\'') {
+        /* start the next pipeline stage */
+        if (*buf == '|') {
+            if (argc == stage->argv) {
+                printf("syntax error near '|'\n");
+                argv[0] = NULL;
+                return -1;
+            }
+            argv[argc++] = NULL;
+            stage->nredirs = cmd->nredirs - stage->redir;
+            stage = &cmd->stage[cmd->nstages++];
+            stage->argv = argc;
+            stage->redir = cmd->nredirs;
+            stage->nassigns = 0;
             buf++;
-            delim = strchr(buf, '\'');
+            continue;
         }
-        else {
-            delim = strchr(buf, ' ');
+
+        /* a redirection, with an optional descriptor number */
+        fd = -1;
+        if (isdigit((unsigned char)buf[0]) && end - buf > 1 &&
+            (buf[1] == '<' || buf[1] == '>')) {
+            fd = *buf++ - '0';
+        }
+        if (*buf == '<' || *buf == '>') {
+            buf = getredir(buf, end, fd, &cmd->redir[cmd->nredirs++], &out, cmd);
+            if (buf == NULL) {
+                argv[0] = NULL;
+                return -1;
+            }
+            continue;
         }
+
+        quoted = *buf == '\'';
+        buf = getword(buf, end, &out, cmd, &argv[argc]);
+        if (!quoted && hasglob(argv[argc])) {
+            cmd->globs[cmd->nglobs++] = argc;
+        }
+        argc++;
     }
 
     argv[argc] = NULL;
+    stage->nredirs = cmd->nredirs - stage->redir;
 
     /* ignore blank line */
-    if (argc == 0) {
+    if (argc == 0 && cmd->nredirs == 0) {
         return 0;
     }
 
     /* should the job run in the background? */
-    bg = (*argv[argc-1] == '&');
+    bg = argc > 0 && argv[argc-1] && (*argv[argc-1] == '&');
     if (bg != 0) {
         argv[--argc] = NULL;
     }
+
+    /* every stage needs a command */
+    if (argc == stage->argv) {
+        printf("syntax error near '%s'\n",
+            bg ? "&" : cmd->nstages > 1 ? "|" : "newline");
+        argv[0] = NULL;
+        return -1;
+    }
+    cmd->bg = bg;
     return bg;
 }
 
 /*
- * builtin_cmd - If the user has typed a built-int
- *    command then execute it immediately.
- *    quit, fg, bg, jobs
+ * parseline - Parse a line that is not kept, into an arena
+ *    reused by the next call (see parsein)
  */
-int builtin_cmd(char **argv)
+int parseline(const char *cmdline, size_t len, struct cmdline_t *cmd)
 {
-    char *cmd = argv[0];
-    sigset_t mask, prev;
-
-    /* Blocks all signals while determining
-     * whether command is built in
-     */
-     Sigfillset(&mask);
-     Sigprocmask(SIG_BLOCK, &mask, &prev);
+    static struct arena_t arena;
 
-    if (!strcmp(cmd, "quit")) {
-        Sigprocmask(SIG_SETMASK, &prev, NULL);
-        exit(0);
-    }
-    if (!strcmp(cmd, "jobs")) {
-        listjobs(jobs);
-        Sigprocmask(SIG_SETMASK, &prev, NULL);
-        return 1;
-    }
-    if (!strcmp(cmd, "bg") || !strcmp(cmd, "fg")) {
-        Sigprocmask(SIG_SETMASK, &prev, NULL);
-        do_bgfg(argv);
-        return 1;
-    }
-
-    Sigprocmask(SIG_SETMASK, &prev, NULL);
-    return 0;
+    return parsein(cmdline, len, cmd, &arena, 0);
 }
 
 /*
- * waitfg - Block until process pid is no longer the
- *    foreground process
+ * waitfor - Block, reaping jobs as they change, until done(arg)
+ *    is true, the deadline (CLOCK_MONOTONIC; NULL for none)
+ *    passes, or ctrl-c is typed while there is no foreground
+ *    job. done is called with SIGCHLD blocked, and a NULL done
+ *    is never true. Returns 1 once done, 0 at the deadline and
+ *    -1 if interrupted.
+ *
+ * SIGCHLD and SIGINT stay blocked except while waiting, so
+ *    neither can slip in between the checks and the wait.
  */
-void waitfg(pid_t pid)
+int waitfor(int (*done)(void *arg), void *arg, const struct timespec *deadline)
 {
+    struct timespec now, left, *timeout = NULL;
     sigset_t mask, prev;
-
-    Log("WAITFG [0]\n", 11);
+    int r;
 
     Sigemptyset(&mask);
     Sigaddset(&mask, SIGCHLD);
-
+    Sigaddset(&mask, SIGINT);
     Sigprocmask(SIG_BLOCK, &mask, &prev);
+    atomic_intr = 0;
 
-    Log("WAITFG [1]\n", 11);
+    while (TRUE) {
+        if (done && done(arg)) {
+            r = 1;
+            break;
+        }
+        if (atomic_intr) {
+            r = -1;
+            break;
+        }
+        if (deadline) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline->tv_sec - now.tv_sec;
+            left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0) {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000;
+            }
+            if (left.tv_sec < 0) {
+                r = 0;
+                break;
+            }
+            timeout = &left;
+        }
 
-    while (atomic_fggpid == pid) {
-        Log("WAITFG [2]\n", 11);
-        Sigsuspend(&prev);
-    }
+        Trace(TR_WAITFG, 2, atomic_fggpid, 0);
 
-    Log("WAITFG [3]\n", 11);
+        /* The event loop reaps jobs while waiting for events */
+        if (evloop) {
+            ev_wait(timeout == NULL ? -1 : left.tv_sec > 1000000 ? 1000000000 :
+                    left.tv_sec * 1000 + (left.tv_nsec + 999999) / 1000000);
+        }
+        else {
+            ppoll(NULL, 0, timeout, &prev);
+        }
+    }
 
     Sigprocmask(SIG_SETMASK, &prev, NULL);
+    return r;
+}
+
+/* fgdone - Is there no foreground job? */
+static int fgdone(void *arg)
+{
+    return !atomic_fggpid;
+}
+
+/*
+ * waitfg - Block until there is no foreground job. A parallel
+ *    job keeps its one process group for its whole life, its
+ *    next instances joining it, so the foreground group stays
+ *    the job's until the job ends. What was reported about the
+ *    job is printed before return.
+ */
+void waitfg(void)
+{
+    Trace(TR_WAITFG, 0, atomic_fggpid, 0);
+
+    while (waitfor(fgdone, NULL, NULL) < 0)
+        ;           /* ctrl-c went to the job */
+
+    Trace(TR_WAITFG, 3, 0, 0);
+    out_drain();
 }
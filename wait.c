@@ -0,0 +1,205 @@
+#include "header.h"
+
+/*
+ * The wait builtin
+ *
+ * wait blocks in waitfor, the same sleep on SIGCHLD (or on the
+ *    event loop) that waitfg uses, and checks its targets each
+ *    time the shell has reaped something; it never polls. A job
+ *    that ended before wait was called is found among the
+ *    statuses the job table keeps of ended jobs.
+ */
+
+#define WAIT_TIMEOUT 124        /* status when -t runs out */
+
+struct wtarget_t {              /* A job being waited for     */
+  pid_t pid;                    /* its leader                 */
+  int done;                     /* has ended (or stopped)     */
+  int status;                   /* its status, once done      */
+};
+
+struct waitset_t {              /* What one wait waits for    */
+  struct wtarget_t *t;
+  int n;
+  int any;                      /* the first to end (-n)      */
+  int status;                   /* status wait returns        */
+};
+
+/*
+ * waitdone - Have the targets ended? A stopped job counts, so
+ *    wait cannot hang on it; with -n, so does one that had ended
+ *    before wait was called. Called with SIGCHLD blocked.
+ */
+static int waitdone(void *arg)
+{
+    struct waitset_t *ws = arg;
+    struct wtarget_t *t;
+    struct job_t *job;
+    int ndone = 0;
+
+    for (t = ws->t; t < ws->t + ws->n; t++) {
+        if (!t->done) {
+            if ((job = getjobpid(&jobs, t->pid)) == NULL) {
+                t->done = 1;
+                t->status = endstatus(t->pid, 0);
+                if (t->status < 0) {
+                    t->status = 0;      /* forgotten: too many ended */
+                }
+            }
+            else if (job->state == ST) {
+                t->done = 1;
+                t->status = 128 + job->stopsig;
+            }
+            else {
+                continue;
+            }
+        }
+        ws->status = t->status;
+        if (ws->any) {
+            return 1;
+        }
+        ndone++;
+    }
+    return ndone == ws->n;
+}
+
+/*
+ * findtarget - Resolve a %jid or pid to the job it names. A job
+ *    that has already ended is done at once. Returns -1, after
+ *    printing an error, if there is no such job.
+ */
+static int findtarget(const char *spec, struct wtarget_t *t)
+{
+    struct job_t *job;
+    pid_t pid = 0;
+    jid_t jid = 0;
+    char *end;
+
+    if (*spec == '%') {
+        jid = strtol(spec + 1, &end, 10);
+    }
+    else {
+        pid = strtol(spec, &end, 10);
+    }
+    if (*end || (jid <= 0 && pid <= 0)) {
+        printf("wait: %s: argument must be a PID or jobid\n", spec);
+        return -1;
+    }
+
+    t->done = 0;
+    job = jid ? getjobjid(&jobs, jid) : getjobpid(&jobs, pid);
+    if (job != NULL) {
+        t->pid = job->pid;
+        return 0;
+    }
+    if ((t->status = endstatus(pid, jid)) < 0) {
+        printf("wait: %s: No such job\n", spec);
+        return -1;
+    }
+    t->done = 1;
+    return 0;
+}
+
+/*
+ * do_wait - Execute the builtin wait command
+ *
+ *    wait [-n] [-t secs] [%jid | pid]...
+ *
+ *    Wait for the given jobs, or every running background job,
+ *    to end, and return the status of the last one given (0 if
+ *    none were). With -n, wait only for the first of them and
+ *    return its status. -t gives up after secs seconds with
+ *    status 124; ctrl-c gives up with 130.
+ */
+int do_wait(char **argv)
+{
+    struct waitset_t ws;
+    struct timespec deadline;
+    sigset_t mask, prev;
+    double secs = -1;
+    char *end;
+    int i, n, r, given, status = 0;
+
+    memset(&ws, 0, sizeof(ws));
+    for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n")) {
+            ws.any = 1;
+        }
+        else if (!strcmp(argv[i], "-t") && argv[i+1]) {
+            secs = strtod(argv[++i], &end);
+            if (*end || end == argv[i] || secs < 0) {
+                printf("wait: %s: invalid timeout\n", argv[i]);
+                return 1;
+            }
+        }
+        else {
+            printf("wait: %s: invalid option\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Sigfillset(&mask);
+    lockjobs(&mask, &prev);
+
+    /* With no jobs given, wait for the running background jobs */
+    for (n = 0; argv[i + n]; n++)
+        ;
+    given = n > 0;
+    if (!given) {
+        for (n = 0, r = 0; r < jobs.size; r++) {
+            n += jobs.slots[r].pid != 0 && jobs.slots[r].state == BG;
+        }
+    }
+    if (n > 0 && (ws.t = malloc(n * sizeof(*ws.t))) == NULL) {
+        unix_error("wait error");
+    }
+
+    if (given) {
+        for (; argv[i]; i++) {
+            if (findtarget(argv[i], &ws.t[ws.n]) < 0) {
+                status = 127;
+                continue;
+            }
+            ws.n++;
+        }
+    }
+    else {
+        for (r = 0; r < jobs.size; r++) {
+            if (jobs.slots[r].pid != 0 && jobs.slots[r].state == BG) {
+                ws.t[ws.n].pid = jobs.slots[r].pid;
+                ws.t[ws.n++].done = 0;
+            }
+        }
+    }
+    unlockjobs(&prev);
+
+    if (ws.n == 0) {
+        free(ws.t);
+        return ws.any ? 127 : status;
+    }
+
+    if (secs >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)secs;
+        deadline.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    r = waitfor(waitdone, &ws, secs >= 0 ? &deadline : NULL);
+    free(ws.t);
+    out_drain();
+
+    if (r < 0) {
+        return 128 + SIGINT;
+    }
+    if (r == 0) {
+        return WAIT_TIMEOUT;
+    }
+    if (!given && !ws.any) {
+        return 0;
+    }
+    return status ? status : ws.status;
+}
@@ -91,19 +91,6 @@ void Sio_error(char *msg, int len)
     _exit(1);
 }
 
-/*
- * Execve - wrapper for execve function
- */
-void Execve(const char *filename,
-            char *argv[],
-            char *envp[])
-{
-    if (execve(filename, argv, envp) < 0) {
-        printf("%s: Command not found.\n", argv[0]);
-        exit(0);
-    }
-}
-
 /*
  * Setpgid - wrapper for setpgid function
  */
@@ -146,3 +133,13 @@ void Sigdelset(sigset_t *mask, int sig)
         unix_error("Sigdelset error");
     }
 }
+
+/*
+ * Pipe2 - wrapper for pipe2 function
+ */
+void Pipe2(int fds[2], int flags)
+{
+    if (pipe2(fds, flags) < 0) {
+        unix_error("Pipe2 error");
+    }
+}
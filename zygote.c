@@ -0,0 +1,407 @@
+#include "header.h"
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sched.h>
+
+
+/*
+ * Zygote launcher (mpsh -z)
+ *
+ * At startup, before the shell has grown, it forks a small
+ *    helper, the zygote, and from then on asks it to create
+ *    children instead of copying itself. The cost of a launch
+ *    then depends on the zygote's size, which never changes,
+ *    and not on the shell's.
+ *
+ * The zygote creates each child with clone(CLONE_PARENT), so
+ *    the child's parent is the shell, not the zygote: the shell
+ *    gets its SIGCHLD, reaps it with wait4 and runs job control
+ *    on it exactly as if it had forked the child itself.
+ *
+ * A request is one SOCK_SEQPACKET message holding the program,
+ *    its argument and environment strings, its process group,
+ *    signal mask, CPU mask, resource limits and descriptor moves. Descriptors the child
+ *    needs from the shell (pipe ends, opened redirection files,
+ *    stdio copies) travel with it as SCM_RIGHTS. The zygote
+ *    replies once the child has exec'd, or with the errno of
+ *    the step that failed, which is what posix_spawn reports.
+ *    A request too big for one message is refused, and the
+ *    caller launches that command itself.
+ */
+
+#define ZYGOTEFDS 10            /* zygote descriptors are kept above this */
+#define ZYMSGMAX  131072        /* largest request, in bytes              */
+#define ZYMAXFDS  64            /* descriptors passed with one request    */
+
+struct zyact_t {                /* One descriptor move in the child    */
+  int from;                     /* source: a passed fd's index, or fd  */
+  int to;                       /* descriptor to move it onto          */
+  int passed;                   /* if true, from indexes the passed fds */
+};
+
+struct zyreq_t {                /* A launch request                   */
+  pid_t pgid;                   /* process group to join, 0 for new   */
+  sigset_t mask;                /* signal mask to exec with           */
+  int pinned;                   /* if true, run on cpus               */
+  cpu_set_t cpus;
+  int nlimits;                  /* resource limits to set             */
+  struct limit_t limits[NLIMITS];
+  int nacts;                    /* zyact_t entries that follow        */
+  int argc;                     /* then path, argc args and envc      */
+  int envc;                     /*   environment strings, each NUL    */
+};                              /*   terminated                       */
+
+struct zyrep_t {                /* The zygote's reply                 */
+  pid_t pid;                    /* the child, or -1                   */
+  int err;                      /* errno if the launch failed         */
+};
+
+static int zyfd = -1;           /* shell's end of the socketpair      */
+static pid_t zypid;             /* the zygote                         */
+
+/* highfd - Move fd to ZYGOTEFDS or above, close-on-exec */
+static int highfd(int fd)
+{
+    int high;
+
+    if (fd < 0 || fd >= ZYGOTEFDS) {
+        return fd;
+    }
+    high = fcntl(fd, F_DUPFD_CLOEXEC, ZYGOTEFDS);
+    close(fd);
+    return high;
+}
+
+/*
+ * zychild - Set up and exec a newly cloned child. Runs between
+ *    clone and exec, so only async-signal-safe calls are made;
+ *    a failure is written to errfd and the child exits.
+ */
+static void zychild(struct zyreq_t *req, struct zyact_t *acts, int *fds,
+                   char *path, char **argv, char **envp, int errfd)
+{
+    int i, from;
+
+    Sigprocmask(SIG_SETMASK, &req->mask, NULL);
+    if (setpgid(0, req->pgid) < 0) {
+        goto fail;
+    }
+    if (req->pinned && sched_setaffinity(0, sizeof(req->cpus), &req->cpus) < 0) {
+        goto fail;
+    }
+    if (lim_apply(req->limits, req->nlimits) < 0) {
+        goto fail;
+    }
+    for (i = 0; i < req->nacts; i++) {
+        from = acts[i].passed ? fds[acts[i].from] : acts[i].from;
+        if (from == acts[i].to) {
+            fcntl(from, F_SETFD, 0);
+        }
+        else if (dup2(from, acts[i].to) < 0) {
+            goto fail;
+        }
+    }
+    execve(path, argv, envp);
+
+fail:
+    i = errno;
+    write(errfd, &i, sizeof(i));
+    _exit(127);
+}
+
+/*
+ * zyserve - Build the child a request describes and launch it,
+ *    filling in the reply. fds are the nfds descriptors passed
+ *    with the request, which the zygote closes afterwards.
+ */
+static void zyserve(char *msg, size_t len, int *fds, int nfds, struct zyrep_t *rep)
+{
+    static char **strs;
+    static int nstrs;
+    struct zyreq_t *req = (struct zyreq_t *)msg;
+    struct zyact_t *acts = (struct zyact_t *)(req + 1);
+    char *p = (char *)(acts + req->nacts), *end = msg + len;
+    int i, n = 1 + req->argc + 1 + req->envc + 1, errpipe[2];
+    ssize_t got;
+    pid_t pid;
+
+    rep->pid = -1;
+    rep->err = EINVAL;
+
+    /* Point at each string, path first */
+    if (n > nstrs) {
+        if ((strs = realloc(strs, n * sizeof(*strs))) == NULL) {
+            rep->err = ENOMEM;
+            return;
+        }
+        nstrs = n;
+    }
+    for (i = 0; i < n; i++) {
+        if (i == 1 + req->argc || i == n - 1) {
+            strs[i] = NULL;
+            continue;
+        }
+        if (p >= end) {
+            return;
+        }
+        strs[i] = p;
+        p += strlen(p) + 1;
+    }
+    for (i = 0; i < req->nacts; i++) {
+        if (acts[i].passed && (acts[i].from < 0 || acts[i].from >= nfds)) {
+            return;
+        }
+    }
+
+    if (pipe2(errpipe, O_CLOEXEC) < 0) {
+        rep->err = errno;
+        return;
+    }
+    errpipe[0] = highfd(errpipe[0]);
+    errpipe[1] = highfd(errpipe[1]);
+
+    /* The child is the shell's, not ours */
+    pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+    if (pid == CHILD) {
+        zychild(req, acts, fds, strs[0], &strs[1], &strs[2 + req->argc],
+                errpipe[1]);
+    }
+    close(errpipe[1]);
+
+    if (pid < 0) {
+        rep->err = errno;
+    }
+    else {
+        /* EOF means the exec succeeded and closed the pipe */
+        while ((got = read(errpipe[0], &rep->err, sizeof(rep->err))) < 0 &&
+               errno == EINTR) {
+        }
+        rep->pid = pid;
+        if (got == sizeof(rep->err)) {
+            rep->pid = -1;      /* the shell reaps what is left */
+        }
+        else {
+            rep->err = 0;
+        }
+    }
+    close(errpipe[0]);
+}
+
+/* zymain - The zygote's loop: serve requests until the shell goes away */
+static void zymain(int fd)
+{
+    static char msg[ZYMSGMAX];
+    char cbuf[CMSG_SPACE(ZYMAXFDS * sizeof(int))];
+    struct iovec iov = { msg, sizeof(msg) };
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    struct zyrep_t rep;
+    int i, nfds, fds[ZYMAXFDS];
+    ssize_t len;
+
+    while (TRUE) {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+
+        if ((len = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC)) <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            _exit(0);
+        }
+
+        nfds = 0;
+        for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+            }
+        }
+        for (i = 0; i < nfds; i++) {
+            fds[i] = highfd(fds[i]);
+        }
+
+        if ((size_t)len < sizeof(struct zyreq_t) || (mh.msg_flags & MSG_TRUNC)) {
+            rep.pid = -1;
+            rep.err = EMSGSIZE;
+        }
+        else {
+            zyserve(msg, len, fds, nfds, &rep);
+        }
+
+        for (i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        if (send(fd, &rep, sizeof(rep), MSG_NOSIGNAL) < 0) {
+            _exit(0);
+        }
+    }
+}
+
+/*
+ * zy_init - Start the zygote. Called early in main, while the
+ *    shell is still small, before any signal handlers are set.
+ */
+void zy_init(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        unix_error("socketpair error");
+    }
+    sv[0] = highfd(sv[0]);
+    sv[1] = highfd(sv[1]);
+
+    if ((zypid = Fork()) == CHILD) {
+        close(sv[0]);
+
+        /* Keep out of the terminal's way and die with the shell */
+        setpgid(0, 0);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() == 1) {
+            _exit(0);
+        }
+        zymain(sv[1]);
+    }
+    close(sv[1]);
+    zyfd = sv[0];
+}
+
+/* addstr - Append s, NUL included, to the request being built */
+static int addstr(char *msg, size_t *len, const char *s)
+{
+    size_t n = strlen(s) + 1;
+
+    if (*len + n > ZYMSGMAX) {
+        return -1;
+    }
+    memcpy(msg + *len, s, n);
+    *len += n;
+    return 0;
+}
+
+/*
+ * zy_launch - Ask the zygote to launch proc with the signal
+ *    mask set to mask, storing the child's PID (or -1, with
+ *    errno set) in *pid. Returns -1 without launching anything
+ *    if the zygote is not running or the request does not fit
+ *    in a message; the caller then launches proc itself.
+ */
+int zy_launch(struct proc_t *proc, sigset_t *mask, pid_t *pid)
+{
+    static char msg[ZYMSGMAX];
+    char cbuf[CMSG_SPACE(ZYMAXFDS * sizeof(int))];
+    struct zyreq_t *req = (struct zyreq_t *)msg;
+    struct zyact_t *act;
+    struct zyrep_t rep;
+    struct redir_t *r;
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr *cm;
+    int i, nfds = 0, fds[ZYMAXFDS];
+    size_t len;
+    ssize_t got;
+
+    if (zyfd < 0) {
+        return -1;
+    }
+    if (sizeof(*req) + (proc->nmoves + proc->nredirs) * sizeof(*act) > ZYMSGMAX ||
+        proc->nmoves + proc->nredirs > ZYMAXFDS) {
+        return -1;
+    }
+
+    req->pgid = proc->pgid;
+    req->mask = *mask;
+    req->pinned = proc->cpus != NULL;
+    if (proc->cpus) {
+        req->cpus = *proc->cpus;
+    }
+    req->nlimits = lim_merge(req->limits, proc->limits, proc->nlimits);
+    req->nacts = proc->nmoves + proc->nredirs;
+    act = (struct zyact_t *)(req + 1);
+
+    /* Pipe ends and opened files are the shell's and are passed
+     * along; a dup such as 2>&1 names the child's own descriptor
+     */
+    for (i = 0; i < proc->nmoves; i++, act++) {
+        act->passed = 1;
+        act->from = nfds;
+        act->to = proc->moves[i].to;
+        fds[nfds++] = proc->moves[i].from;
+    }
+    for (i = 0; i < proc->nredirs; i++, act++) {
+        r = &proc->redir[i];
+        act->to = r->fd;
+        act->passed = r->path != NULL || r->from >= ZYGOTEFDS;
+        act->from = act->passed ? nfds : r->from;
+        if (act->passed) {
+            fds[nfds++] = r->from;
+        }
+    }
+
+    len = (char *)act - msg;
+    if (addstr(msg, &len, proc->path) < 0) {
+        return -1;
+    }
+    for (req->argc = 0; proc->argv[req->argc]; req->argc++) {
+        if (addstr(msg, &len, proc->argv[req->argc]) < 0) {
+            return -1;
+        }
+    }
+    for (req->envc = 0; proc->envp[req->envc]; req->envc++) {
+        if (addstr(msg, &len, proc->envp[req->envc]) < 0) {
+            return -1;
+        }
+    }
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = msg;
+    iov.iov_len = len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds) {
+        mh.msg_control = cbuf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+
+    while ((got = sendmsg(zyfd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (got < 0) {
+        if (errno != EMSGSIZE) {
+            zy_stop();          /* the zygote is gone */
+        }
+        return -1;
+    }
+    while ((got = recv(zyfd, &rep, sizeof(rep), 0)) < 0 && errno == EINTR) {
+    }
+    if (got != sizeof(rep)) {
+        zy_stop();
+        return -1;
+    }
+    if (rep.pid < 0 && rep.err == EMSGSIZE) {
+        return -1;
+    }
+
+    *pid = rep.pid;
+    errno = rep.err;
+    return 0;
+}
+
+/* zy_stop - Stop using the zygote; launches fall back to spawning */
+void zy_stop(void)
+{
+    if (zyfd >= 0) {
+        close(zyfd);
+        zyfd = -1;
+        kill(zypid, SIGKILL);
+    }
+}